@@ -0,0 +1,96 @@
+#include "allocations.h"
+
+#include <stdlib.h>
+
+static Allocations counters = {0, 0};
+static long current = 0;
+
+#if defined(__GLIBC__)
+
+#include <malloc.h>
+
+// glibc exports its allocator under these names, so malloc() and friends can be replaced by wrappers
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+extern "C" void __libc_free(void *pointer);
+
+static void track(void *pointer)
+{
+    if (pointer != nullptr)
+    {
+        counters.count++;
+        current += malloc_usable_size(pointer);
+        if (current > counters.peak)
+        {
+            counters.peak = current;
+        }
+    }
+}
+
+static void untrack(void *pointer)
+{
+    if (pointer != nullptr)
+    {
+        current -= malloc_usable_size(pointer);
+    }
+}
+
+extern "C" void *malloc(size_t size) __THROW
+{
+    void *pointer = __libc_malloc(size);
+    track(pointer);
+    return pointer;
+}
+
+extern "C" void *calloc(size_t count, size_t size) __THROW
+{
+    void *pointer = __libc_calloc(count, size);
+    track(pointer);
+    return pointer;
+}
+
+extern "C" void *realloc(void *pointer, size_t size) __THROW
+{
+    long before = pointer ? malloc_usable_size(pointer) : 0;
+    void *moved = __libc_realloc(pointer, size);
+    if (moved != nullptr || size == 0)
+    {
+        current -= before;
+        track(moved);
+    }
+    return moved;
+}
+
+extern "C" void free(void *pointer) __THROW
+{
+    untrack(pointer);
+    __libc_free(pointer);
+}
+
+bool allocationsTracked()
+{
+    return true;
+}
+
+#else
+
+bool allocationsTracked()
+{
+    return false;
+}
+
+#endif
+
+/// @brief Restarts counting, the heap in use at this point counts as 0 bytes.
+void resetAllocations()
+{
+    counters.count = 0;
+    counters.peak = 0;
+    current = 0;
+}
+
+Allocations allocations()
+{
+    return counters;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Heap usage since the last `resetAllocations()`, counted by interposing `malloc()` and friends.
+struct Allocations
+{
+    uint32_t count; /// number of `malloc()`, `calloc()` and `realloc()` calls
+    long peak;      /// maximum number of heap bytes in use
+};
+
+/// @return true if allocations are counted, which requires glibc
+bool allocationsTracked();
+void resetAllocations();
+Allocations allocations();
@@ -0,0 +1,298 @@
+#line 2 "benchmarks.ino"
+
+#include <ExpressLink.h>
+#include <ExpressLinkCBOR.h>
+
+#include "allocations.h"
+
+// Host-side benchmarks of the command and parsing hot paths, run with: make && ./benchmarks.out
+// Prints one JSON object per benchmark (JSON Lines), for regression tracking.
+
+/// Accepts every written byte and answers each command line with a canned response.
+/// After `limit` responses (0 for no limit), every further command is answered with `last`.
+class LoopbackStream : public Stream {
+  public:
+    LoopbackStream(const String &r) : reply(r) {}
+
+    size_t write(uint8_t c) {
+      if (c == '\n') {
+        respond();
+      }
+      return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+      const uint8_t *end = buffer + size;
+      while ((buffer = (const uint8_t *)memchr(buffer, '\n', end - buffer)) != nullptr) {
+        respond();
+        buffer++;
+      }
+      return size;
+    }
+
+    int available() {
+      return pending + lastPending;
+    }
+
+    int read() {
+      int c = peek();
+      if (pending > 0) {
+        pending--;
+      } else if (lastPending > 0) {
+        lastPending--;
+      }
+      return c;
+    }
+
+    int peek() {
+      if (pending > 0) {
+        return (uint8_t)reply.charAt((reply.length() - pending % reply.length()) % reply.length());
+      }
+      return lastPending ? (uint8_t)last.charAt(last.length() - lastPending) : -1;
+    }
+
+    void respond() {
+      responses++;
+      if (limit == 0 || responses <= limit) {
+        pending += reply.length();
+      } else {
+        lastPending += last.length();
+      }
+    }
+
+    String reply;
+    size_t pending = 0;
+    String last;
+    size_t lastPending = 0;
+    unsigned long limit = 0;
+    unsigned long responses = 0;
+};
+
+class BenchmarkExpressLink : public ExpressLink {
+  public:
+    using ExpressLink::escape;
+};
+
+/// Builds a pretty-printed JSON document of roughly `size` bytes, with line breaks that need escaping.
+String json(size_t size) {
+  String doc = "{\n";
+  for (int i = 0; doc.length() + 40 < size; i++) {
+    doc += "  \"sensor" + String(i) + "\": {\"value\": " + String(i * 3.25) + ", \"unit\": \"C\"},\n";
+  }
+  doc += "  \"ok\": true\n}";
+  return doc;
+}
+
+String escaped(const String &value) {
+  BenchmarkExpressLink escaper;
+  String e = value;
+  escaper.escape(e);
+  return e;
+}
+
+typedef void (*Operation)(ExpressLink &el, LoopbackStream &s, void *context);
+
+/// Runs `operation` repeatedly for 200 ms, after one warm-up run, and prints the results as a JSON object.
+/// @param bytes payload bytes processed by each operation
+void benchmark(const char *name, LoopbackStream &s, size_t bytes, Operation operation, void *context = nullptr) {
+  ExpressLink el;
+  String reply = s.reply;
+  s.reply = "OK\r\n";
+  el.begin(s);
+  s.reply = reply;
+  operation(el, s, context);
+
+  unsigned long iterations = 0;
+  resetAllocations();
+  unsigned long start = micros();
+  while (micros() - start < 200000) {
+    operation(el, s, context);
+    iterations++;
+  }
+  unsigned long elapsed = micros() - start;
+  Allocations heap = allocations();
+
+  double seconds = elapsed / 1e6;
+  Serial.print("{\"benchmark\": \"");
+  Serial.print(name);
+  Serial.print("\", \"iterations\": ");
+  Serial.print(iterations);
+  Serial.print(", \"ops_per_s\": ");
+  Serial.print((unsigned long)(iterations / seconds));
+  Serial.print(", \"bytes_per_s\": ");
+  Serial.print((unsigned long)(bytes * iterations / seconds));
+  if (allocationsTracked()) {
+    Serial.print(", \"allocs_per_op\": ");
+    Serial.print((double)heap.count / iterations, 2);
+    Serial.print(", \"peak_heap_bytes\": ");
+    Serial.print(heap.peak);
+  }
+  Serial.println("}");
+}
+
+void publish(ExpressLink &el, LoopbackStream &, void *context) {
+  const String &message = *(const String *)context;
+  el.publish(1, message.c_str(), message.length());
+}
+
+void readLine(ExpressLink &el, LoopbackStream &s, void *) {
+  s.pending = s.reply.length();
+  el.readLine();
+}
+
+void shadowDoc(ExpressLink &el, LoopbackStream &, void *) {
+  el.shadowGetDoc();
+}
+
+void pemRead(ExpressLink &el, LoopbackStream &, void *) {
+  el.config.getCertificate();
+}
+
+bool discard(uint32_t, const uint8_t *, size_t, void *) {
+  return true;
+}
+
+void otaRead(ExpressLink &el, LoopbackStream &s, void *) {
+  s.responses = 0;
+  el.otaDownload(discard, nullptr, 256);
+}
+
+void eventDrain(ExpressLink &el, LoopbackStream &, void *) {
+  el.processEvents(16);
+}
+
+/// A typical sensor record, published as JSON or CBOR.
+struct SensorRecord {
+  unsigned long time;
+  float temperature;
+  float humidity;
+  float pressure;
+  int rssi;
+  bool ok;
+};
+
+const SensorRecord record = {1700000000UL, 21.5, 45.25, 1013.2, -67, true};
+
+String sensorJSON(const SensorRecord &r) {
+  return "{\"ts\":" + String(r.time) + ",\"temp\":" + String(r.temperature, 2) + ",\"hum\":" + String(r.humidity, 2) +
+         ",\"pres\":" + String(r.pressure, 1) + ",\"rssi\":" + String(r.rssi) + ",\"ok\":" + (r.ok ? "true" : "false") + "}";
+}
+
+void sensorCBOR(ExpressLinkCBOR &cbor, const SensorRecord &r) {
+  cbor.beginMap(6);
+  cbor.addKey("ts");
+  cbor.addUnsigned(r.time);
+  cbor.addKey("temp");
+  cbor.addFloat(r.temperature);
+  cbor.addKey("hum");
+  cbor.addFloat(r.humidity);
+  cbor.addKey("pres");
+  cbor.addFloat(r.pressure);
+  cbor.addKey("rssi");
+  cbor.addInt(r.rssi);
+  cbor.addKey("ok");
+  cbor.addBool(r.ok);
+}
+
+/// Prints the message and wire sizes of `records` sensor records as JSON and as CBOR.
+void encodingSize(const char *name, int records) {
+  String json = records > 1 ? "[" : "";
+  uint8_t buffer[1024];
+  ExpressLinkCBOR cbor(buffer, sizeof(buffer));
+  if (records > 1) {
+    cbor.beginArray(records);
+  }
+  for (int i = 0; i < records; i++) {
+    SensorRecord r = record;
+    r.time += i;
+    r.temperature += i * 0.25;
+    json += (i > 0 ? "," : "") + sensorJSON(r);
+    sensorCBOR(cbor, r);
+  }
+  json += records > 1 ? "]" : "";
+
+  Serial.print("{\"benchmark\": \"");
+  Serial.print(name);
+  Serial.print("\", \"json_bytes\": ");
+  Serial.print(json.length());
+  Serial.print(", \"cbor_bytes\": ");
+  Serial.print(cbor.length());
+  Serial.print(", \"json_wire_bytes\": ");
+  Serial.print(escaped(json).length());
+  Serial.print(", \"cbor_wire_bytes\": ");
+  Serial.print(cbor.wireLength());
+  Serial.print(", \"ratio\": ");
+  Serial.print((double)cbor.wireLength() / escaped(json).length(), 2);
+  Serial.println("}");
+}
+
+void publishJSONRecord(ExpressLink &el, LoopbackStream &, void *) {
+  String message = sensorJSON(record);
+  el.publish(1, message.c_str(), message.length());
+}
+
+void publishCBORRecord(ExpressLink &el, LoopbackStream &, void *) {
+  uint8_t buffer[64];
+  ExpressLinkCBOR cbor(buffer, sizeof(buffer));
+  sensorCBOR(cbor, record);
+  cbor.publish(el, 1);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  String small = "{\"temperature\": 21.5}";
+  LoopbackStream ok("OK\r\n");
+  benchmark("publish small", ok, small.length(), publish, &small);
+  String kb1 = json(1024);
+  benchmark("publish 1KB escape", ok, kb1.length(), publish, &kb1);
+  String kb4 = json(4096);
+  benchmark("publish 4KB escape", ok, kb4.length(), publish, &kb4);
+
+  LoopbackStream line1(escaped(kb1) + "\r\n");
+  benchmark("readLine 1KB unescape", line1, kb1.length(), readLine);
+  LoopbackStream line4(escaped(kb4) + "\r\n");
+  benchmark("readLine 4KB unescape", line4, kb4.length(), readLine);
+
+  String doc = json(800);
+  LoopbackStream shadow("OK 1 " + escaped(doc) + "\r\n");
+  benchmark("shadow doc read", shadow, doc.length(), shadowDoc);
+
+  String pem = "OK20 -----BEGIN CERTIFICATE-----\r\n";
+  for (int i = 0; i < 19; i++) {
+    pem += "MIIDWTCCAkGgAwIBAgIUKx7u9ZKr2sH3JzEXAMPLEbase64linepadding0123456\r\n";
+  }
+  pem += "-----END CERTIFICATE-----\r\n";
+  LoopbackStream certificate(pem);
+  benchmark("PEM read", certificate, pem.length(), pemRead);
+
+  String chunk = "OK 100 ";
+  uint16_t sum = 0;
+  for (int i = 0; i < 256; i++) {
+    const char hex[] = "0123456789ABCDEF";
+    chunk += hex[i >> 4];
+    chunk += hex[i & 15];
+    sum += i;
+  }
+  chunk += " " + String(sum, HEX) + "\r\n";
+  LoopbackStream ota(chunk);
+  ota.limit = 16;
+  ota.last = "OK 0\r\n";
+  benchmark("OTA 4KB chunk read", ota, 16 * 256, otaRead);
+
+  encodingSize("size sensor record", 1);
+  encodingSize("size 10 sensor records", 10);
+  benchmark("publish JSON record", ok, sensorJSON(record).length(), publishJSONRecord);
+  uint8_t buffer[64];
+  ExpressLinkCBOR cbor(buffer, sizeof(buffer));
+  sensorCBOR(cbor, record);
+  benchmark("publish CBOR record", ok, cbor.length(), publishCBORRecord);
+
+  LoopbackStream events("OK 1 1 MSG\r\n");
+  benchmark("event drain 16", events, 16 * events.reply.length(), eventDrain);
+
+  exit(0);
+}
+
+void loop() {
+}
@@ -1,177 +1,705 @@
 #include "ExpressLink.h"
 
+/// @brief true if messages of `level` are compiled in, see `EXPRESSLINK_LOG_LEVEL`
+#define LOG_ENABLED(level) (EXPRESSLINK_LOG_LEVEL >= ExpressLink::level)
+
+static size_t readStream(uint8_t *buffer, size_t size, void *context);
+
 ExpressLinkConfig::ExpressLinkConfig(ExpressLink &el) : expresslink(el)
 {
     // constructor
+    invalidate();
+}
+
+/// @brief Enables the write-through cache for configuration values.
+///
+/// Values read or written are remembered, so repeated reads are served without `AT+CONF?`, and writes of an unchanged
+/// value are skipped. The cache is invalidated by `ExpressLink::reset()`, `ExpressLink::factoryReset()`, `CONF` commands
+/// sent with `ExpressLink::cmd()`, and `STARTUP` or `CONFMODE` events. Passphrase and multi-line (PEM) values are never cached.
+/// @param enable true to enable, false to disable and clear the cache
+void ExpressLinkConfig::enableCache(bool enable)
+{
+    caching = enable;
+    invalidate();
+}
+
+/// @brief Forgets all cached configuration values, e.g., after changing the configuration outside of this class.
+void ExpressLinkConfig::invalidate()
+{
+    for (auto &entry : cache)
+    {
+        entry.key[0] = '\0';
+    }
+}
+
+/// @return index of the cache entry for `key`, or -1
+int ExpressLinkConfig::lookup(const char *key)
+{
+    if (!caching)
+    {
+        return -1;
+    }
+    for (int i = 0; i < EXPRESSLINK_CONFIG_CACHE; i++)
+    {
+        if (cache[i].key[0] != '\0' && strcmp(cache[i].key, key) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/// @brief Drops the cached value of the key written by a `CONF {key}={value}` command, whichever way it is sent.
+/// @param command command without the `AT+` prefix, possibly only its header
+void ExpressLinkConfig::written(const char *command, size_t length)
+{
+    if (!caching || length < 5 || strncmp(command, "CONF ", 5) != 0)
+    {
+        return;
+    }
+    const char *end = (const char *)memchr(command + 5, '=', length - 5);
+    size_t n = (end ? end : command + length) - (command + 5);
+    char key[sizeof(cache[0].key)];
+    if (n >= sizeof(key))
+    {
+        return; // never cached
+    }
+    memcpy(key, command + 5, n);
+    key[n] = '\0';
+    int i = lookup(key);
+    if (i >= 0)
+    {
+        cache[i].key[0] = '\0';
+    }
+}
+
+/// @brief Remembers `value` for `key`, replacing the oldest entry if the cache is full.
+/// A value that cannot be cached drops the previous value of `key` from the cache.
+void ExpressLinkConfig::store(const char *key, const char *value, size_t length)
+{
+    int i = lookup(key);
+#if EXPRESSLINK_STATIC
+    bool fits = length < EXPRESSLINK_CONFIG_VALUE;
+#else
+    bool fits = true;
+#endif
+    if (!caching || !fits || strlen(key) >= sizeof(cache[0].key) || strcmp(key, "Passphrase") == 0 || memchr(value, '\n', length) != nullptr)
+    {
+        if (i >= 0)
+        {
+            cache[i].key[0] = '\0';
+        }
+        return;
+    }
+    if (i < 0)
+    {
+        i = cacheNext;
+        cacheNext = (cacheNext + 1) % EXPRESSLINK_CONFIG_CACHE;
+        strcpy(cache[i].key, key);
+    }
+    auto &cached = cache[i].value;
+    cached = "";
+    cached.reserve(length);
+    for (size_t n = 0; n < length; n++)
+    {
+        cached += value[n];
+    }
+}
+
+/// @brief Answers a command from the cache, leaving the same state as a successful command without sending it.
+/// @param value response of the command, i.e., the cached value for `AT+CONF?`
+void ExpressLinkConfig::hit(const char *value)
+{
+    expresslink.response = value;
+    expresslink.error = "";
+    expresslink.result = expresslink.response.c_str();
+    expresslink.additionalLines = 0;
+    expresslink.parseError(0);
+}
+
+/// @brief Reads a configuration value into `ExpressLink::response`, from the cache if possible.
+/// @return true on success, false on error
+bool ExpressLinkConfig::query(const char *key)
+{
+    int i = lookup(key);
+    if (i >= 0)
+    {
+        hit(cache[i].value.c_str());
+        return true;
+    }
+    if (!expresslink.execute("CONF? ", key, strlen(key)))
+    {
+        return false;
+    }
+    store(key, expresslink.response.c_str(), expresslink.response.length());
+    return true;
+}
+
+/// @brief equivalent to: AT+CONF? {key}
+/// @param key name of the configuration dictionary entry
+/// @return true on success, false on error. Value is available in `ExpressLink::response`.
+bool ExpressLinkConfig::get(const char *key)
+{
+    return query(key);
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief equivalent to: AT+CONF? {key}
+/// @param key name of the configuration dictionary entry
+/// @return true on success, false on error. Value is available in `ExpressLink::response`.
+bool ExpressLinkConfig::get(String key)
+{
+    return query(key.c_str());
+}
+
+/// @brief equivalent to: AT+CONF {key}={value}
+/// @param key name of the configuration dictionary entry
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::set(String key, String value)
+{
+    return set(key.c_str(), value.c_str(), value.length());
 }
+#endif
 
-String ExpressLinkConfig::getTopic(uint8_t index)
+/// @brief equivalent to: AT+CONF {key}={value}, without any heap allocations
+/// @param key name of the configuration dictionary entry
+/// @param value to be written to configuration dictionary
+/// @param length number of bytes in `value`
+/// @return true on success, false on error
+bool ExpressLinkConfig::set(const char *key, const char *value, size_t length)
+{
+    int i = lookup(key);
+    if (i >= 0 && cache[i].value.length() == length && memcmp(cache[i].value.c_str(), value, length) == 0)
+    {
+        hit("");
+        return true; // unchanged
+    }
+    char header[32];
+    if (snprintf(header, sizeof(header), "CONF %s=", key) >= (int)sizeof(header))
+    {
+        return expresslink.rejectCommand("key too long");
+    }
+    if (!expresslink.execute(header, value, length))
+    {
+        return false;
+    }
+    store(key, value, length);
+    return true;
+}
+
+/// @brief equivalent to: AT+CONF {key}={value}, with the value read from a `Stream`, e.g., a PEM file.
+/// The value is escaped and written to the UART chunk by chunk, without buffering it.
+/// @param key name of the configuration dictionary entry
+/// @param value stream to read the value from, until `available()` returns 0
+/// @return true on success, false on error
+bool ExpressLinkConfig::set(const char *key, Stream &value)
+{
+    int i = lookup(key);
+    if (i >= 0)
+    {
+        cache[i].key[0] = '\0';
+    }
+    char header[32];
+    if (snprintf(header, sizeof(header), "CONF %s=", key) >= (int)sizeof(header))
+    {
+        return expresslink.rejectCommand("key too long");
+    }
+    return expresslink.executeProduced(header, readStream, &value);
+}
+
+/// @brief equivalent to: AT+CONF? {key} pem, passing the PEM-formatted value line by line to `sink`.
+/// Only one line is held in RAM at a time, see `ExpressLink::cmdLines()`.
+/// @param key name of the configuration dictionary entry, e.g., `RootCA`
+/// @param sink called for every line, including the `-----BEGIN` and `-----END` lines
+/// @param context passed to each `sink` call
+/// @return true on success, false on error
+bool ExpressLinkConfig::getPEM(const char *key, PEMSink sink, void *context)
+{
+    char command[32];
+    if (snprintf(command, sizeof(command), "CONF? %s pem", key) >= (int)sizeof(command))
+    {
+        return expresslink.rejectCommand("key too long");
+    }
+    return expresslink.cmdLines(command, sink, context);
+}
+
+/// @brief State of `decodePEMLine()`.
+struct DERDecoder
+{
+    ExpressLinkConfig::DERSink sink;
+    void *context;
+    uint32_t bits;    /// decoded bits not delivered yet, in the lowest `count` bits
+    uint8_t count;
+    bool inside;      /// true between a `-----BEGIN` and an `-----END` line
+    bool aborted;     /// true once the sink returned false
+};
+
+/// @return value of the base64 digit `c`, or -1 for padding and other characters
+static int base64Value(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+    {
+        return c - 'A';
+    }
+    if (c >= 'a' && c <= 'z')
+    {
+        return c - 'a' + 26;
+    }
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0' + 52;
+    }
+    return (c == '+') ? 62 : (c == '/') ? 63 : -1;
+}
+
+/// @brief `ExpressLink::LineSink` that decodes the base64 lines of a PEM value and passes the bytes to a `DERSink`.
+static bool decodePEMLine(const char *line, size_t length, void *context)
+{
+    DERDecoder &decoder = *(DERDecoder *)context;
+    if (strncmp(line, "-----", 5) == 0)
+    {
+        decoder.inside = strncmp(line, "-----BEGIN", 10) == 0;
+        decoder.count = 0;
+        return true;
+    }
+    if (!decoder.inside)
+    {
+        return true;
+    }
+    uint8_t chunk[48]; // a 64 character PEM line
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        int value = base64Value(line[i]);
+        if (value < 0)
+        {
+            continue;
+        }
+        decoder.bits = decoder.bits << 6 | value;
+        decoder.count += 6;
+        if (decoder.count >= 8)
+        {
+            decoder.count -= 8;
+            chunk[n++] = (uint8_t)(decoder.bits >> decoder.count);
+        }
+        if (n == sizeof(chunk) && !decoder.sink(chunk, n, decoder.context))
+        {
+            decoder.aborted = true;
+            return false;
+        }
+        n %= sizeof(chunk);
+    }
+    if (n > 0 && !decoder.sink(chunk, n, decoder.context))
+    {
+        decoder.aborted = true;
+        return false;
+    }
+    return true;
+}
+
+/// @brief equivalent to: AT+CONF? {key} pem, decoding the PEM-formatted value and passing its binary (DER) contents to
+/// `sink`, e.g., to hash or verify a certificate. The contents of several PEM blocks are passed one after the other.
+/// @param key name of the configuration dictionary entry, e.g., `Certificate`
+/// @param sink called with every decoded chunk of up to 48 bytes
+/// @param context passed to each `sink` call
+/// @return true on success, false on error or if `sink` returned false
+bool ExpressLinkConfig::getDER(const char *key, DERSink sink, void *context)
 {
-    expresslink.cmd("CONF? Topic" + String(index));
+    DERDecoder decoder = {sink, context, 0, 0, false, false};
+    return getPEM(key, decodePEMLine, &decoder) && !decoder.aborted;
+}
+
+ExpressLinkText ExpressLinkConfig::getTopic(uint8_t index)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "Topic%u", index);
+    query(key);
     return expresslink.response;
 }
 
+#if !EXPRESSLINK_STATIC
 bool ExpressLinkConfig::setTopic(uint8_t index, String topic)
 {
-    return expresslink.cmd("CONF Topic" + String(index) + "=" + topic);
+    return setTopic(index, topic.c_str());
+}
+#endif
+
+bool ExpressLinkConfig::setTopic(uint8_t index, const char *topic)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "Topic%u", index);
+    return set(key, topic, strlen(topic));
+}
+
+/// @brief equivalent to: AT+CONF? Shadow{index}
+/// @return value from the configuration dictionary
+ExpressLinkText ExpressLinkConfig::getShadow(uint8_t index)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "Shadow%u", index);
+    query(key);
+    return expresslink.response;
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief equivalent to: AT+CONF Shadow{index}={name}
+/// @return true on success, false on error
+bool ExpressLinkConfig::setShadow(uint8_t index, String name)
+{
+    return setShadow(index, name.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF Shadow{index}={name}
+/// @return true on success, false on error
+bool ExpressLinkConfig::setShadow(uint8_t index, const char *name)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "Shadow%u", index);
+    return set(key, name, strlen(name));
 }
 
 /// @brief equivalent to: AT+CONF? About
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getAbout()
+ExpressLinkText ExpressLinkConfig::getAbout()
 {
-    expresslink.cmd("CONF? About");
+    query("About");
     return expresslink.response;
 }
 
 /// @brief equivalent to: AT+CONF? Version
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getVersion()
+ExpressLinkText ExpressLinkConfig::getVersion()
 {
-    expresslink.cmd("CONF? Version");
+    query("Version");
     return expresslink.response;
 }
 
 /// @brief equivalent to: AT+CONF? TechSpec
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getTechSpec()
+ExpressLinkText ExpressLinkConfig::getTechSpec()
 {
-    expresslink.cmd("CONF? TechSpec");
+    query("TechSpec");
     return expresslink.response;
 }
 
 /// @brief equivalent to: AT+CONF? ThingName
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getThingName()
+ExpressLinkText ExpressLinkConfig::getThingName()
 {
-    expresslink.cmd("CONF? ThingName");
+    query("ThingName");
     return expresslink.response;
 }
 
 /// @brief equivalent to: AT+CONF? Certificate pem
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getCertificate()
+ExpressLinkText ExpressLinkConfig::getCertificate()
 {
     expresslink.cmd("CONF? Certificate pem");
     expresslink.response = expresslink.readLine(expresslink.additionalLines);
     return expresslink.response;
 }
 
+/// @brief equivalent to: AT+CONF? Certificate pem, passing the PEM-formatted value line by line to `sink`, see `getPEM()`.
+/// @return true on success, false on error
+bool ExpressLinkConfig::getCertificate(PEMSink sink, void *context)
+{
+    return getPEM("Certificate", sink, context);
+}
+
 /// @brief equivalent to: AT+CONF? CustomName
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getCustomName()
+ExpressLinkText ExpressLinkConfig::getCustomName()
 {
-    expresslink.cmd("CONF? CustomName");
+    query("CustomName");
     return expresslink.response;
 }
 
+#if !EXPRESSLINK_STATIC
 /// @brief equivalent to: AT+CONF CustomName={value}
 /// @param value to be written to configuration dictionary
 /// @return true on success, false on error
 bool ExpressLinkConfig::setCustomName(const String &value)
 {
-    return expresslink.cmd("CONF CustomName=" + value);
+    return setCustomName(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF CustomName={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setCustomName(const char *value)
+{
+    return set("CustomName", value, strlen(value));
 }
 
 /// @brief equivalent to: AT+CONF? Endpoint
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getEndpoint()
+ExpressLinkText ExpressLinkConfig::getEndpoint()
 {
-    expresslink.cmd("CONF? Endpoint");
+    query("Endpoint");
     return expresslink.response;
 }
 
+#if !EXPRESSLINK_STATIC
 /// @brief equivalent to: AT+CONF Endpoin={value}
 /// @param value to be written to configuration dictionary
 /// @return true on success, false on error
 bool ExpressLinkConfig::setEndpoint(const String &value)
 {
-    return expresslink.cmd("CONF Endpoint=" + value);
+    return setEndpoint(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF Endpoin={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setEndpoint(const char *value)
+{
+    return set("Endpoint", value, strlen(value));
 }
 
 /// @brief equivalent to: AT+CONF? Endpoint pem
 /// @return value from the configuration dictionary as multi-line PEM-formatted string
-String ExpressLinkConfig::getRootCA()
+ExpressLinkText ExpressLinkConfig::getRootCA()
 {
     expresslink.cmd("CONF? RootCA pem");
     expresslink.response = expresslink.readLine(expresslink.additionalLines);
     return expresslink.response;
 }
 
+/// @brief equivalent to: AT+CONF? RootCA pem, passing the PEM-formatted value line by line to `sink`, see `getPEM()`.
+/// @return true on success, false on error
+bool ExpressLinkConfig::getRootCA(PEMSink sink, void *context)
+{
+    return getPEM("RootCA", sink, context);
+}
+
+#if !EXPRESSLINK_STATIC
 /// @brief equivalent to: AT+CONF RootCA={value}
 /// @param value to be written to configuration dictionary as multi-line PEM-formatted string
 /// @return true on success, false on error
 bool ExpressLinkConfig::setRootCA(const String &value)
 {
-    return expresslink.cmd("CONF RootCA=" + value);
+    return setRootCA(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF RootCA={value}
+/// @param value to be written to configuration dictionary as multi-line PEM-formatted string
+/// @return true on success, false on error
+bool ExpressLinkConfig::setRootCA(const char *value)
+{
+    return set("RootCA", value, strlen(value));
+}
+
+/// @brief equivalent to: AT+CONF RootCA={value}, streamed from `value`, see `set(const char *, Stream &)`.
+/// @param value stream to read the multi-line PEM-formatted string from
+/// @return true on success, false on error
+bool ExpressLinkConfig::setRootCA(Stream &value)
+{
+    return set("RootCA", value);
 }
 
 /// @brief equivalent to: AT+CONF? ShadowToken
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getShadowToken()
+ExpressLinkText ExpressLinkConfig::getShadowToken()
 {
-    expresslink.cmd("CONF? ShadowToken");
+    query("ShadowToken");
     return expresslink.response;
 }
 
+#if !EXPRESSLINK_STATIC
+/// @brief equivalent to: AT+CONF ShadowToken={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setShadowToken(const String &value)
+{
+    return setShadowToken(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF ShadowToken={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setShadowToken(const char *value)
+{
+    return set("ShadowToken", value, strlen(value));
+}
+
 /// @brief equivalent to: AT+CONF? DefenderPeriod
 /// @return value from the configuration dictionary
 uint32_t ExpressLinkConfig::getDefenderPeriod()
 {
-    expresslink.cmd("CONF? DefenderPeriod");
+    query("DefenderPeriod");
     return expresslink.response.toInt();
 }
 
+/// @brief equivalent to: AT+CONF DefenderPeriod={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setDefenderPeriod(const uint32_t value)
+{
+    char text[12];
+    int length = snprintf(text, sizeof(text), "%lu", (unsigned long)value);
+    return set("DefenderPeriod", text, length);
+}
+
 /// @brief equivalent to: AT+CONF? HOTAcertificate pem
 /// @return value from the configuration dictionary as multi-line PEM-formatted string
-String ExpressLinkConfig::getHOTAcertificate()
+ExpressLinkText ExpressLinkConfig::getHOTAcertificate()
 {
     expresslink.cmd("CONF? HOTAcertificate pem");
     expresslink.response = expresslink.readLine(expresslink.additionalLines);
     return expresslink.response;
 }
 
+/// @brief equivalent to: AT+CONF? HOTAcertificate pem, passing the PEM-formatted value line by line to `sink`, see `getPEM()`.
+/// @return true on success, false on error
+bool ExpressLinkConfig::getHOTAcertificate(PEMSink sink, void *context)
+{
+    return getPEM("HOTAcertificate", sink, context);
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief equivalent to: AT+CONF HOTAcertificate={value}
+/// @param value to be written to configuration dictionary as multi-line PEM-formatted string
+/// @return true on success, false on error
+bool ExpressLinkConfig::setHOTAcertificate(const String &value)
+{
+    return setHOTAcertificate(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF HOTAcertificate={value}
+/// @param value to be written to configuration dictionary as multi-line PEM-formatted string
+/// @return true on success, false on error
+bool ExpressLinkConfig::setHOTAcertificate(const char *value)
+{
+    return set("HOTAcertificate", value, strlen(value));
+}
+
+/// @brief equivalent to: AT+CONF HOTAcertificate={value}, streamed from `value`, see `set(const char *, Stream &)`.
+/// @param value stream to read the multi-line PEM-formatted string from
+/// @return true on success, false on error
+bool ExpressLinkConfig::setHOTAcertificate(Stream &value)
+{
+    return set("HOTAcertificate", value);
+}
+
 /// @brief equivalent to: AT+CONF? OTAcertificate pem
 /// @return value from the configuration dictionary as multi-line PEM-formatted string
-String ExpressLinkConfig::getOTAcertificate()
+ExpressLinkText ExpressLinkConfig::getOTAcertificate()
 {
     expresslink.cmd("CONF? OTAcertificate pem");
     expresslink.response = expresslink.readLine(expresslink.additionalLines);
     return expresslink.response;
 }
 
+/// @brief equivalent to: AT+CONF? OTAcertificate pem, passing the PEM-formatted value line by line to `sink`, see `getPEM()`.
+/// @return true on success, false on error
+bool ExpressLinkConfig::getOTAcertificate(PEMSink sink, void *context)
+{
+    return getPEM("OTAcertificate", sink, context);
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief equivalent to: AT+CONF OTAcertificate={value}
+/// @param value to be written to configuration dictionary as multi-line PEM-formatted string
+/// @return true on success, false on error
+bool ExpressLinkConfig::setOTAcertificate(const String &value)
+{
+    return setOTAcertificate(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF OTAcertificate={value}
+/// @param value to be written to configuration dictionary as multi-line PEM-formatted string
+/// @return true on success, false on error
+bool ExpressLinkConfig::setOTAcertificate(const char *value)
+{
+    return set("OTAcertificate", value, strlen(value));
+}
+
+/// @brief equivalent to: AT+CONF OTAcertificate={value}, streamed from `value`, see `set(const char *, Stream &)`.
+/// @param value stream to read the multi-line PEM-formatted string from
+/// @return true on success, false on error
+bool ExpressLinkConfig::setOTAcertificate(Stream &value)
+{
+    return set("OTAcertificate", value);
+}
+
 /// @brief equivalent to: AT+CONF? SSID
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getSSID()
+ExpressLinkText ExpressLinkConfig::getSSID()
 {
-    expresslink.cmd("CONF? SSID");
+    query("SSID");
     return expresslink.response;
 }
 
+#if !EXPRESSLINK_STATIC
 /// @brief equivalent to: AT+CONF SSID={value}
 /// @param value to be written to configuration dictionary
 /// @return true on success, false on error
 bool ExpressLinkConfig::setSSID(const String &value)
 {
-    return expresslink.cmd("CONF SSID=" + value);
+    return setSSID(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF SSID={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setSSID(const char *value)
+{
+    return set("SSID", value, strlen(value));
 }
 
+#if !EXPRESSLINK_STATIC
 /// @brief equivalent to: AT+CONF Passphrase={value}
 /// @param value to be written to configuration dictionary
 /// @return true on success, false on error
 bool ExpressLinkConfig::setPassphrase(const String &value)
 {
-    return expresslink.cmd("CONF Passphrase=" + value);
+    return setPassphrase(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF Passphrase={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setPassphrase(const char *value)
+{
+    return set("Passphrase", value, strlen(value));
 }
 
 /// @brief equivalent to: AT+CONF? APN
 /// @return value from the configuration dictionary
-String ExpressLinkConfig::getAPN()
+ExpressLinkText ExpressLinkConfig::getAPN()
 {
-    expresslink.cmd("CONF? APN");
+    query("APN");
     return expresslink.response;
 }
 
+#if !EXPRESSLINK_STATIC
+/// @brief equivalent to: AT+CONF APN={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setAPN(const String &value)
+{
+    return setAPN(value.c_str());
+}
+#endif
+
+/// @brief equivalent to: AT+CONF APN={value}
+/// @param value to be written to configuration dictionary
+/// @return true on success, false on error
+bool ExpressLinkConfig::setAPN(const char *value)
+{
+    return set("APN", value, strlen(value));
+}
+
 ExpressLink::ExpressLink(void) : config(*this)
 {
     // constructor
@@ -182,56 +710,84 @@ ExpressLink::ExpressLink(void) : config(*this)
 /// @param event GPIO pin where ExpressLink EVENT pin is connected, set to -1 if not connected (default)
 /// @param wake GPIO pin where ExpressLink WAKE pin is connected, set to -1 if not connected (default)
 /// @param reset GPIO pin where ExpressLink RESET pin is connected, set to -1 if not connected (default)
-/// @param debug uses the default `Serial` stream to print AT commands and responses. Only enable if `Serial` is connected to a different UART than the ExpressLink UART.
+/// @param debug uses the default `Serial` stream to print AT commands and responses, see `setLogSink()`. Only enable if `Serial` is connected to a different UART than the ExpressLink UART.
+/// @param eventInterrupt attaches an interrupt to the EVENT pin, so `eventPending()` also reports events signaled while the pin was not sampled. Only one ExpressLink instance can use it.
 /// @return true on success, false on error
-bool ExpressLink::begin(Stream &u, int event, int wake, int reset, bool d)
+bool ExpressLink::begin(Stream &u, int event, int wake, int reset, bool d, bool eventInterrupt)
 {
-    debug = d;
+    if (d)
+    {
+        setLogSink(printLog, &Serial);
+    }
     uart = &u;
     uart->setTimeout(120 * 1000); // 120 seconds
-
+    queue = queueTail = nullptr;
+    pendingLines = 0;
+    lateResponse = false;
+#if EXPRESSLINK_STATISTICS
+    resetStatistics();
+#endif
+    resetIdleStatistics();
+
+    resetPin = reset;
     if (resetPin >= 0)
     {
-        resetPin = reset;
+        digitalWrite(resetPin, HIGH); // RESET is active low, do not hold the module in reset
         pinMode(resetPin, OUTPUT);
     }
+    eventPin = event;
     if (eventPin >= 0)
     {
-        eventPin = event;
         pinMode(eventPin, INPUT);
+        if (eventInterrupt)
+        {
+            eventSignaled = digitalRead(eventPin) == HIGH;
+            attachInterrupt(digitalPinToInterrupt(eventPin), onEventInterrupt, RISING);
+        }
     }
+    wakePin = wake;
     if (wakePin >= 0)
     {
-        wakePin = wake;
         pinMode(wakePin, OUTPUT);
     }
     return selfTest();
 }
 
-String ExpressLink::readLine(uint32_t count)
+/// @brief Reads (additional) response lines, e.g., multi-line PEM-formatted strings.
+/// @param count number of lines to read
+/// @param timeout maximum time to wait in milliseconds, 0 to use `setTimeout()`
+/// @return unescaped and trimmed lines, or an empty string if a timeout happened
+ExpressLinkText ExpressLink::readLine(uint32_t count, uint32_t timeout)
 {
-    unsigned long start = millis();
-    String response;
-    uint16_t line_count = 0;
-    for (uint8_t i = 0; i < count; i++)
+    unsigned long start = now();
+    unsigned long limit = timeout ? timeout : this->timeout;
+    ExpressLinkText response;
+    uint32_t line_count = 0;
+    while (line_count < count && now() - start < limit)
     {
-        do
+        const uint8_t *segment;
+        bool eol;
+        size_t n = buffered(segment, eol);
+        if (n == 0)
         {
-            int c = uart->read();
-            if (c >= 0)
-            {
-                response += (char)c;
-            }
-            if (c == '\n')
-            {
-                line_count++;
-                break;
-            }
-        } while (millis() - start < 120000);
-    }
-    if (line_count != count)
-    {
-        // error, not enough lines read - potential UART timeout happened
+            idle(nullptr, start);
+            continue;
+        }
+        response.reserve(response.length() + n);
+        for (size_t i = 0; i < n; i++)
+        {
+            response += (char)segment[i];
+        }
+        consume(n);
+        if (eol)
+        {
+            line_count++;
+        }
+    }
+    pendingLines = (pendingLines > line_count) ? pendingLines - line_count : 0;
+    if (line_count != count)
+    {
+        // error, not enough lines read - potential UART timeout happened
         return "";
     }
 
@@ -240,92 +796,1204 @@ String ExpressLink::readLine(uint32_t count)
     return response;
 }
 
+/// @brief Same as `readLine()`, but streams each line into `sink` as it is received instead of concatenating the lines,
+/// e.g., the payload line of `GET`.
+/// @param sink called with the unescaped fragments of each line, and once with `end` set after each line
+/// @param context passed to each `sink` call
+/// @param count number of lines to read
+/// @param timeout maximum time to wait in milliseconds, 0 to use `setTimeout()`
+/// @return true if all lines were received, false if a timeout happened
+bool ExpressLink::streamLine(ResponseSink sink, void *context, uint32_t count, uint32_t timeout)
+{
+    unsigned long start = now();
+    unsigned long limit = timeout ? timeout : this->timeout;
+    streamSink = sink;
+    streamContext = context;
+    streamState = StreamOn;
+    streamEscape = false;
+    uint32_t line_count = 0;
+    while (line_count < count && now() - start < limit)
+    {
+        if (receiveLine() >= 0)
+        {
+            line_count++;
+            streamState = StreamOn;
+            streamEscape = false;
+            continue;
+        }
+        idle(nullptr, start);
+    }
+    streamSink = nullptr;
+    streamState = StreamOff;
+    pendingLines = (pendingLines > line_count) ? pendingLines - line_count : 0;
+    return line_count == count;
+}
+
+/// @brief Returns the escape sequence character for `c`, see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-delimiters
+/// @return `A` for `\\n`, `D` for `\\r`, `\\` for `\\`, or 0 if `c` is written as-is
+static inline char escapeCode(char c)
+{
+    return (c == '\n') ? 'A' : (c == '\r') ? 'D' : (c == '\\') ? '\\' : 0;
+}
+
+/// @brief Unescapes `length` bytes of `value` in-place, in a single pass.
+/// @return length of the unescaped value
+static size_t unescapeInPlace(char *value, size_t length)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = value[i];
+        if (c == '\\' && i + 1 < length)
+        {
+            char e = value[++i];
+            c = (e == 'A') ? '\n' : (e == 'D') ? '\r' : e;
+        }
+        value[n++] = c;
+    }
+    return n;
+}
+
 /// @brief Escapes string in-place so it can be written to ExpressLink UART
 /// @param value string (will be modified)
-void ExpressLink::escape(String &value)
+/// @return false if the escaped string does not fit into `value`, which is left unchanged then and must not be sent
+bool ExpressLink::escape(ExpressLinkText &value)
 {
     // see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-delimiters
-    value.replace("\n", "\\A");
-    value.replace("\r", "\\D");
-    value.replace("\\", "\\\\");
+    size_t length = value.length();
+    size_t extra = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        extra += escapeCode(value[i]) ? 1 : 0;
+    }
+    if (extra == 0)
+    {
+        return true;
+    }
+    if (!value.reserve(length + extra))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < extra; i++)
+    {
+        value += ' '; // grow to the escaped length, within the reserved capacity
+    }
+
+    // fill from the end, so every byte is moved exactly once
+    char *buffer = value.begin();
+    size_t n = length + extra;
+    for (size_t i = length; i-- > 0;)
+    {
+        char c = buffer[i];
+        char e = escapeCode(c);
+        if (e)
+        {
+            buffer[--n] = e;
+            c = '\\';
+        }
+        buffer[--n] = c;
+    }
+    return true;
 }
 
 /// @brief Unescapes string in-place after reading it from ExpressLink UART
 /// @param value string (will be modified)
-void ExpressLink::unescape(String &value)
+void ExpressLink::unescape(ExpressLinkText &value)
 {
     // see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-delimiters
-    value.replace("\\A", "\n");
-    value.replace("\\D", "\r");
-    value.replace("\\\\", "\\");
+    if (value.length() > 0)
+    {
+        value.remove(unescapeInPlace(value.begin(), value.length()));
+    }
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief Execute AT command and reads all response lines. Escaping and unescaping is handled automatically. Check class attribute `response` (if true returned) and `error` (if false returned).
+/// @param command: e.g., AT+CONNECT or SUBSCRIBE1 (with or without the `AT+` prefix)
+/// @return true on success, false on error
+bool ExpressLink::cmd(String command)
+{
+    return cmd(command.c_str(), command.length());
+}
+#endif
+
+/// @brief Same as `ExpressLink::cmd(String)`, without any heap allocations.
+/// @param command: e.g., AT+CONNECT or SUBSCRIBE1 (with or without the `AT+` prefix)
+/// @return true on success, false on error
+bool ExpressLink::cmd(const char *command)
+{
+    return cmd(command, strlen(command));
+}
+
+/// @brief Same as `ExpressLink::cmd(String)`, without any heap allocations.
+/// @param command: e.g., AT+CONNECT or SUBSCRIBE1 (with or without the `AT+` prefix)
+/// @param length number of bytes in `command`
+/// @param timeout maximum time to wait for the response in milliseconds, 0 to use `setTimeout()`
+/// @return true on success, false on error
+bool ExpressLink::cmd(const char *command, size_t length, uint32_t timeout)
+{
+    if (length >= 3 && strncmp(command, "AT+", 3) == 0)
+    {
+        command += 3;
+        length -= 3;
+    }
+    if (length >= 5 && strncmp(command, "CONF ", 5) == 0)
+    {
+        config.invalidate(); // bypasses the configuration cache
+    }
+    return execute("", command, length, timeout);
+}
+
+/// @brief Executes an AT command and streams the payload of its `OK` response line into `sink` while it is received,
+/// e.g., a large shadow document or message. The payload is neither stored in the line buffer nor in `response`, so
+/// it is not limited by `EXPRESSLINK_MAX_LINE`. Error responses are stored in `error` as usual. Not repeated by the `RetryPolicy`.
+/// @param command: e.g., SHADOW GET DOC (with or without the `AT+` prefix)
+/// @param sink called with the unescaped payload after the `OK ` or `OK{n} ` prefix, not called if there is none
+/// @param context passed to each `sink` call
+/// @param timeout maximum time to wait for the response in milliseconds, 0 to use `setTimeout()`
+/// @return true on success, false on error
+bool ExpressLink::cmdStream(const char *command, ResponseSink sink, void *context, uint32_t timeout)
+{
+    size_t length = strlen(command);
+    if (length >= 3 && strncmp(command, "AT+", 3) == 0)
+    {
+        command += 3;
+        length -= 3;
+    }
+    Command handle;
+    prepare(handle, "", command, length);
+    handle.timeout = timeout;
+    handle.sink = sink;
+    handle.sinkContext = context;
+    enqueue(handle);
+    return wait(handle);
+}
+
+/// @brief Executes an AT command and passes its response line by line to `sink`, e.g., a PEM certificate.
+/// The value after the `OK{n}` prefix and the `n` additional lines are received one at a time into the line buffer,
+/// so the response is never held in RAM as a whole. Lines longer than `EXPRESSLINK_MAX_LINE` are truncated.
+/// @param command: e.g., CONF? RootCA pem (with or without the `AT+` prefix)
+/// @param sink called for every line, an empty value after the `OK{n}` prefix is skipped
+/// @param context passed to each `sink` call
+/// @param timeout maximum time to wait for each line in milliseconds, 0 to use `setTimeout()`
+/// @return true on success, false on error or if a timeout happened
+bool ExpressLink::cmdLines(const char *command, LineSink sink, void *context, uint32_t timeout)
+{
+    size_t length = strlen(command);
+    if (length >= 3 && strncmp(command, "AT+", 3) == 0)
+    {
+        command += 3;
+        length -= 3;
+    }
+    Command handle;
+    prepare(handle, "", command, length);
+    handle.timeout = timeout;
+    handle.raw = true;
+    enqueue(handle);
+    if (!wait(handle))
+    {
+        return false;
+    }
+    bool more = *result == '\0' || sink(result, strlen(result), context);
+    while (pendingLines > 0)
+    {
+        int n = readResponse(timeout);
+        if (n < 0)
+        {
+            return false;
+        }
+        pendingLines--;
+        if (more)
+        {
+            more = sink(line, n, context);
+        }
+    }
+    return true;
+}
+
+/// @brief Sets the default response timeout for commands and `readLine()`.
+/// `connect()` always waits up to `TIMEOUT`, as a TCP connection can take that long.
+/// A response arriving after its command timed out is discarded before the next command is sent; if it arrives
+/// later than that, only `executeWithRetry()` with `Error::TimedOut` in `RetryPolicy::retryOn` tells them apart.
+/// @param timeout in milliseconds, 0 to restore `TIMEOUT`
+void ExpressLink::setTimeout(uint32_t timeout)
+{
+    this->timeout = timeout ? timeout : TIMEOUT;
+}
+
+/// @brief Replaces `millis()` as the time source of timeouts, retry delays, statistics and `ExpressLinkPacer`,
+/// e.g., with a simulated clock in tests.
+/// @param clock function returning the time in milliseconds, nullptr to use `millis()` again
+/// @param context passed to each `clock` call
+void ExpressLink::setClock(Clock clock, void *context)
+{
+    this->clock = clock;
+    clockContext = context;
+}
+
+/// @return current time in milliseconds, from the clock set with `setClock()` or `millis()`
+unsigned long ExpressLink::now() const
+{
+    return clock ? clock(clockContext) : millis();
+}
+
+/// @brief Sets how `publish()`, `connect()`, `subscribe()` and the shadow commands are repeated after an error.
+/// The default policy makes a single attempt.
+/// @param policy retry policy, copied
+void ExpressLink::setRetryPolicy(const RetryPolicy &policy)
+{
+    retry = policy;
+    if (retry.attempts == 0)
+    {
+        retry.attempts = 1;
+    }
+}
+
+/// @brief Queues a command without waiting for its response. Call `poll()` until `handle.pending()` returns false.
+/// @param handle caller-owned command handle, must stay valid until the command has completed
+/// @param command: e.g., AT+CONNECT or SUBSCRIBE1 (with or without the `AT+` prefix), must stay valid until the command has completed
+/// @param callback optional function invoked from `poll()` once the command has completed
+/// @param context optional pointer stored in `handle.context`
+/// @return true if queued, false if `handle` is still pending
+bool ExpressLink::cmdAsync(Command &handle, const char *command, Command::Callback callback, void *context)
+{
+    if (handle.pending())
+    {
+        return false;
+    }
+    size_t length = strlen(command);
+    if (length >= 3 && strncmp(command, "AT+", 3) == 0)
+    {
+        command += 3;
+        length -= 3;
+    }
+    prepare(handle, "", command, length);
+    handle.callback = callback;
+    handle.context = context;
+    return enqueue(handle);
+}
+
+/// @brief Queues a publish without waiting for its response. Call `poll()` until `handle.pending()` returns false.
+///
+/// Equivalent to `AT+SEND{topic_index} {message}`.
+/// @param handle caller-owned command handle, must stay valid until the command has completed
+/// @param topic_index the topic index to publish to
+/// @param message raw message to publish, must stay valid until the command has completed
+/// @param length number of bytes in `message`
+/// @param callback optional function invoked from `poll()` once the command has completed
+/// @param context optional pointer stored in `handle.context`
+/// @return true if queued, false if `handle` is still pending
+bool ExpressLink::publishAsync(Command &handle, uint8_t topic_index, const char *message, size_t length, Command::Callback callback, void *context)
+{
+    if (handle.pending())
+    {
+        return false;
+    }
+    char header[12];
+    snprintf(header, sizeof(header), "SEND%u ", topic_index);
+    if (!prepare(handle, header, message, length))
+    {
+        return false;
+    }
+    handle.callback = callback;
+    handle.context = context;
+    return enqueue(handle);
+}
+
+/// @brief Advances the command engine without blocking: sends the next queued command, or consumes available response bytes.
+/// Callbacks of completed commands are invoked from here, at most one per call.
+/// @return true while commands are queued or in flight, false if the engine is idle
+bool ExpressLink::poll()
+{
+    Command *command = queue;
+    if (command == nullptr)
+    {
+        return false;
+    }
+
+    if (command->status == Command::Queued)
+    {
+        if (pendingLines > 0)
+        {
+            // additional lines of the previous response were never read, skip them
+            if (receiveLine() >= 0)
+            {
+                pendingLines--;
+            }
+            else if (now() - command->started >= (command->timeout ? command->timeout : timeout))
+            {
+                pendingLines = 0;
+            }
+            return true;
+        }
+        if (lateResponse)
+        {
+            // the response of a timed-out command may have arrived since, it must not be taken for this one's
+            streamSink = nullptr;
+            streamState = StreamOff;
+            while (receiveLine() >= 0)
+            {
+                if (LOG_ENABLED(LogWarning))
+                {
+                    log(LogWarning, "! discarding late response\n");
+                }
+            }
+            lateResponse = false;
+        }
+        transmit(*command);
+        return true;
+    }
+
+    int length = receiveLine();
+    if (length >= 0 || now() - command->started >= (command->timeout ? command->timeout : timeout))
+    {
+        complete(*command, length);
+    }
+    return true;
+}
+
+/// @brief Formats `AT+{header}{payload}` into the line buffer, writes it to the UART and waits for the response line.
+/// No heap memory is allocated, unless `response` or `error` need to grow.
+/// @param header command name and parameters, e.g., `SEND1 `
+/// @param payload optional raw data appended to the header
+/// @param length number of bytes in `payload`
+/// @param timeout maximum time to wait for the response in milliseconds, 0 to use `setTimeout()`
+/// @return true on success, false on error
+bool ExpressLink::execute(const char *header, const char *payload, size_t length, uint32_t timeout)
+{
+    Command command;
+    if (!prepare(command, header, payload, length))
+    {
+        return false;
+    }
+    command.timeout = timeout;
+    enqueue(command);
+    return wait(command);
+}
+
+/// @brief Same as `execute()`, but repeats the command after errors selected by the `RetryPolicy`, with exponential backoff.
+/// Only for commands that can be sent again unchanged, i.e., not for streamed payloads or `OTA READ`.
+/// After a timeout, a response arriving during the delay is taken as the result of the timed-out attempt,
+/// and the command is not sent again.
+/// @return true on success, false if the last attempt failed
+bool ExpressLink::executeWithRetry(const char *header, const char *payload, size_t length, uint32_t timeout)
+{
+    uint32_t backoff = (retry.delay < retry.maxDelay) ? retry.delay : retry.maxDelay;
+    bool success = execute(header, payload, length, timeout);
+    for (uint8_t attempt = 1; !success; attempt++)
+    {
+        if (attempt >= retry.attempts || (lastError().category() & retry.retryOn) == 0)
+        {
+            return false;
+        }
+
+        uint32_t pause = backoff;
+        uint32_t spread = (uint32_t)((uint64_t)pause * retry.jitter / 100);
+        if (spread > 0)
+        {
+            pause = pause - spread + random(2 * spread + 1);
+        }
+        if (LOG_ENABLED(LogWarning))
+        {
+            log(LogWarning, "! retrying\n");
+        }
+        bool timedOut = lastError().code == Error::Timeout;
+        int late = -1;
+        unsigned long started = now();
+        while (now() - started < pause && late < 0)
+        {
+            if (timedOut)
+            {
+                late = receiveLine(); // the response of the timed-out attempt may still arrive
+                lateResponse = late < 0;
+            }
+            if (late < 0)
+            {
+                idle(nullptr, started);
+            }
+        }
+        backoff = (backoff > retry.maxDelay / 2) ? retry.maxDelay : backoff * 2;
+
+        if (late >= 0)
+        {
+            // resynchronize instead of repeating a command the module has already executed
+            Command command;
+            prepare(command, header, payload, length);
+            command.status = Command::Sent;
+            command.started = started;
+            command.next = queue;
+            queue = &command;
+            if (queueTail == nullptr)
+            {
+                queueTail = &command;
+            }
+            complete(command, late);
+            success = command.status == Command::Succeeded; // a late error is evaluated by the policy like any other
+        }
+        else
+        {
+            success = execute(header, payload, length, timeout);
+        }
+    }
+    return true;
+}
+
+/// @brief Same as `execute()`, with a payload generated chunk by chunk by `producer` while it is written to the UART.
+/// @return true on success, false on error
+bool ExpressLink::executeProduced(const char *header, Command::Producer producer, void *context)
+{
+    Command command;
+    if (!prepare(command, header, "", 0))
+    {
+        return false;
+    }
+    command.producer = producer;
+    command.source = context;
+    enqueue(command);
+    return wait(command);
+}
+
+/// @brief Polls until the queued command has completed.
+/// @return true on success, false on error
+bool ExpressLink::wait(Command &command)
+{
+    while (command.pending())
+    {
+        poll();
+        if (command.pending() && rxCount == 0)
+        {
+            idle(&command, command.started);
+        }
+    }
+    return command.status == Command::Succeeded;
+}
+
+/// @brief Runs the idle hook, measuring the time it takes, and yields to the platform.
+/// @param started `now()` when the wait started
+void ExpressLink::idle(const Command *command, unsigned long started)
+{
+    if (idleHook != nullptr)
+    {
+        unsigned long start = micros();
+        idleHook(*this, command, now() - started, idleContext);
+        idleStats.calls++;
+        idleStats.time += micros() - start;
+    }
+    yield();
+}
+
+/// @brief Registers a hook that runs while commands wait for their response, during retry delays, `readLine()` and
+/// while `ExpressLinkPacer::publish()` waits for the next publish.
+/// @param hook function to call, nullptr to remove the hook
+/// @param context passed to each `hook` call
+void ExpressLink::onIdle(IdleHook hook, void *context)
+{
+    idleHook = hook;
+    idleContext = context;
+}
+
+/// @brief Resets the counters of `idleStatistics()` to 0.
+void ExpressLink::resetIdleStatistics()
+{
+    idleStats.calls = 0;
+    idleStats.time = 0;
+}
+
+/// @brief Fills in a command before `enqueue()`.
+/// @return false if `header` does not fit into `Command::header`, see `rejectCommand()`
+bool ExpressLink::prepare(Command &command, const char *header, const char *payload, size_t length)
+{
+    size_t n = strlen(header);
+    if (n >= sizeof(command.header))
+    {
+        return rejectCommand("command too long");
+    }
+    memcpy(command.header, header, n + 1);
+    command.payload = payload;
+    command.length = length;
+    command.producer = nullptr;
+    command.sink = nullptr;
+    command.raw = false;
+    command.additionalLines = 0;
+    return true;
+}
+
+bool ExpressLink::enqueue(Command &command)
+{
+    command.status = Command::Queued;
+    command.started = now();
+    command.next = nullptr;
+    if (queueTail != nullptr)
+    {
+        queueTail->next = &command;
+    }
+    else
+    {
+        queue = &command;
+    }
+    queueTail = &command;
+    return true;
+}
+
+/// @brief Sends log output to a sink, e.g., `printLog` with a `Print` as context. Replaces the sink set by `begin()`.
+/// @param sink function receiving the log lines, `nullptr` to disable logging
+/// @param context passed to each `sink` call
+/// @param level most verbose level passed to `sink`, levels above `EXPRESSLINK_LOG_LEVEL` are never logged
+void ExpressLink::setLogSink(LogSink sink, void *context, LogLevel level)
+{
+    logSink = sink;
+    logContext = context;
+    logLevel = level;
+}
+
+/// @brief Log sink that writes to the `Print` passed as context, e.g., `Serial`.
+void ExpressLink::printLog(LogLevel, const char *text, size_t length, void *context)
+{
+    ((Print *)context)->write((const uint8_t *)text, length);
+}
+
+/// @brief Passes log output to the sink and records it in the trace. Call sites check `LOG_ENABLED()` first,
+/// so disabled levels compile away.
+void ExpressLink::log(LogLevel level, const char *text, size_t length)
+{
+    if (logSink != nullptr && level <= logLevel)
+    {
+        logSink(level, text, length, logContext);
+    }
+#if EXPRESSLINK_TRACE
+    while (length > 0)
+    {
+        if (!traceOpen)
+        {
+            if (traceSize == EXPRESSLINK_TRACE)
+            {
+                traceHead = (traceHead + 1) % EXPRESSLINK_TRACE; // overwrite the oldest entry
+            }
+            else
+            {
+                traceSize++;
+            }
+            traceEntries[(traceHead + traceSize - 1) % EXPRESSLINK_TRACE].time = now();
+            traceLength = 0;
+            traceOpen = true;
+        }
+        TraceEntry &entry = traceEntries[(traceHead + traceSize - 1) % EXPRESSLINK_TRACE];
+        const char *eol = (const char *)memchr(text, '\n', length);
+        size_t n = eol ? eol - text : length;
+        size_t copy = (n < sizeof(entry.text) - 1 - traceLength) ? n : sizeof(entry.text) - 1 - traceLength;
+        memcpy(entry.text + traceLength, text, copy);
+        traceLength += copy;
+        entry.text[traceLength] = '\0';
+        if (eol)
+        {
+            traceOpen = false;
+            n++;
+        }
+        text += n;
+        length -= n;
+    }
+#endif
+}
+
+void ExpressLink::log(LogLevel level, const char *text)
+{
+    log(level, text, strlen(text));
+}
+
+#if EXPRESSLINK_TRACE
+/// @return number of entries in the trace ring buffer
+uint8_t ExpressLink::traceCount() const
+{
+    return traceSize;
+}
+
+/// @param index 0 for the oldest entry, up to `traceCount() - 1` for the newest
+/// @return trace entry
+const ExpressLink::TraceEntry &ExpressLink::trace(uint8_t index) const
+{
+    return traceEntries[(traceHead + index) % EXPRESSLINK_TRACE];
+}
+
+/// @brief Prints the trace ring buffer as `{millis} {log line}` lines, oldest first, e.g., from a `CONLOST` event handler.
+void ExpressLink::dumpTrace(Print &out) const
+{
+    for (uint8_t i = 0; i < traceSize; i++)
+    {
+        out.print(trace(i).time);
+        out.print(' ');
+        out.println(trace(i).text);
+    }
+}
+#endif
+
+/// @brief Escapes the queued command into the line buffer and writes it to the UART.
+void ExpressLink::transmit(Command &command)
+{
+    logTransmit = LOG_ENABLED(LogDebug);
+    if (logTransmit)
+    {
+        log(LogDebug, "> ");
+    }
+    transmitRaw("AT+", 3);
+    transmitEscaped(command.header, strlen(command.header));
+    if (logTransmit && !EXPRESSLINK_LOG_PAYLOAD && command.header[0] != '\0' && (command.length > 0 || command.producer != nullptr))
+    {
+        log(LogDebug, "...");
+        logTransmit = false; // keep the payload off the log and the trace
+    }
+    transmitEscaped(command.payload, command.length);
+    if (command.producer != nullptr)
+    {
+        uint8_t chunk[64];
+        size_t n;
+        while ((n = command.producer(chunk, sizeof(chunk), command.source)) > 0)
+        {
+            transmitEscaped((const char *)chunk, n);
+        }
+    }
+    logTransmit = LOG_ENABLED(LogDebug);
+    transmitRaw("\n", 1);
+    logTransmit = false;
+    if (command.header[0] != '\0')
+    {
+        config.written(command.header, strlen(command.header));
+    }
+    else
+    {
+        config.written(command.payload, command.length); // `cmd()` passes the command as payload
+    }
+
+    received = 0;
+    streamSink = command.sink;
+    streamContext = command.sinkContext;
+    streamState = (command.sink != nullptr) ? StreamPrefix : StreamOff;
+    streamEscape = false;
+    command.started = now();
+    command.status = Command::Sent;
+}
+
+/// @brief Escapes `length` bytes of `data` on the fly while writing them to the UART, without an intermediate copy.
+/// Runs of bytes that need no escaping are written with a single call.
+void ExpressLink::transmitEscaped(const char *data, size_t length)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        char e = escapeCode(data[i]);
+        if (e != 0)
+        {
+            const char sequence[2] = {'\\', e};
+            transmitRaw(data + start, i - start);
+            transmitRaw(sequence, 2);
+            start = i + 1;
+        }
+    }
+    transmitRaw(data + start, length - start);
+}
+
+/// @brief Writes `length` bytes of `data` to the UART, and to the log while `logTransmit` is set.
+void ExpressLink::transmitRaw(const char *data, size_t length)
+{
+    uart->write((const uint8_t *)data, length);
+#if EXPRESSLINK_STATISTICS
+    stats.bytesSent += length;
+#endif
+    if (LOG_ENABLED(LogDebug) && logTransmit)
+    {
+        log(LogDebug, data, length);
+    }
+}
+
+/// @brief Dequeues the in-flight command, parses its response line and invokes the callback.
+/// @param length length of the response line in `line`, or -1 if a timeout happened
+void ExpressLink::complete(Command &command, int length)
+{
+    queue = command.next;
+    if (queue == nullptr)
+    {
+        queueTail = nullptr;
+    }
+    streamSink = nullptr;
+    streamState = StreamOff;
+
+    if (length < 0)
+    {
+        if (LOG_ENABLED(LogError))
+        {
+            log(LogError, "! timeout\n");
+        }
+    }
+    else
+    {
+        LogLevel level = strncmp(line, "OK", 2) == 0 ? LogDebug : LogWarning;
+        if (level <= EXPRESSLINK_LOG_LEVEL)
+        {
+            log(level, "< ");
+            log(level, line, length);
+            log(level, "\n");
+        }
+    }
+
+    additionalLines = 0;
+    if (length >= 0 && strncmp(line, "OK", 2) == 0)
+    {
+        char *r = line + 2;
+        if (*r == ' ')
+        {
+            r++; // trim off the `OK ` prefix
+        }
+        else if (isDigit(*r))
+        {
+            additionalLines = strtoul(r, &r, 10);
+            if (*r != '\0')
+            {
+                r++; // trim off the separator after the number
+            }
+        }
+        result = r;
+        response = command.raw ? "" : r;
+        error = "";
+        command.status = Command::Succeeded;
+    }
+    else
+    {
+        result = "";
+        error = (length >= 0) ? line : "";
+        response = "";
+        command.status = (length >= 0) ? Command::Failed : Command::TimedOut;
+        lateResponse = length < 0;
+    }
+    parseError(command.status == Command::Succeeded ? 0 : length);
+    if (errorCode == Error::NotConnected && connection.connected)
+    {
+        trackConnection(false); // the connection was lost before its event was processed
+    }
+    recordCommand(command, length);
+    pendingLines = additionalLines;
+    command.additionalLines = additionalLines;
+
+    if (command.callback != nullptr)
+    {
+        command.callback(*this, command);
+    }
+}
+
+/// @brief Error mnemonics, see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-response-formats
+static const struct
+{
+    const char *mnemonic;
+    ExpressLink::Error::Code code;
+} errorMnemonics[] = {
+    {"PARSE ERROR", ExpressLink::Error::ParseError},
+    {"COMMAND TOO LONG", ExpressLink::Error::CommandTooLong},
+    {"OUT OF MEMORY", ExpressLink::Error::OutOfMemory},
+    {"INVALID ESCAPE", ExpressLink::Error::InvalidEscape},
+    {"UNKNOWN COMMAND", ExpressLink::Error::UnknownCommand},
+    {"INVALID PARAMETER", ExpressLink::Error::InvalidParameter},
+    {"INVALID KEY NAME", ExpressLink::Error::InvalidKeyName},
+    {"INVALID TOPIC", ExpressLink::Error::InvalidTopic},
+    {"NOT ALLOWED", ExpressLink::Error::NotAllowed},
+    {"NOT CONNECTED", ExpressLink::Error::NotConnected},
+    {"UNABLE TO CONNECT", ExpressLink::Error::UnableToConnect},
+    {"INVALID OTA UPDATE", ExpressLink::Error::InvalidOTAUpdate},
+};
+
+/// @brief Parses the `ERR{n} {mnemonic} [detail]` line of the completed command into `errorCode`, `errorNumber` and `errorDetail`.
+/// @param length length of the error line in `line`, 0 after a successful command, or -1 if a timeout happened
+void ExpressLink::parseError(int length)
+{
+    errorNumber = 0;
+    errorDetail = 0;
+    if (length <= 0)
+    {
+        errorCode = (length < 0) ? Error::Timeout : Error::None;
+        return;
+    }
+
+    errorCode = Error::Unrecognized;
+    if (strncmp(line, "ERR", 3) != 0)
+    {
+        return;
+    }
+    char *mnemonic;
+    errorNumber = strtoul(line + 3, &mnemonic, 10);
+    while (*mnemonic == ' ')
+    {
+        mnemonic++;
+    }
+    errorDetail = mnemonic - line;
+    for (size_t i = 0; i < sizeof(errorMnemonics) / sizeof(errorMnemonics[0]); i++)
+    {
+        size_t n = strlen(errorMnemonics[i].mnemonic);
+        if (strncmp(mnemonic, errorMnemonics[i].mnemonic, n) == 0 && (mnemonic[n] == ' ' || mnemonic[n] == '\0'))
+        {
+            errorCode = errorMnemonics[i].code;
+            errorDetail += (mnemonic[n] == ' ') ? n + 1 : n;
+            break;
+        }
+    }
+}
+
+/// @brief Fails a command without sending it, e.g., if its header does not fit into the command buffer.
+/// `lastError()` then reports `Error::CommandTooLong` with `reason` as detail.
+/// @return false
+bool ExpressLink::rejectCommand(const char *reason)
+{
+    result = "";
+    response = "";
+    error = reason;
+    errorCode = Error::CommandTooLong;
+    errorNumber = 0;
+    errorDetail = 0;
+    if (LOG_ENABLED(LogWarning))
+    {
+        log(LogWarning, "! rejected: ");
+        log(LogWarning, reason);
+        log(LogWarning, "\n");
+    }
+    return false;
+}
+
+/// @return retry class of the error code
+ExpressLink::Error::Class ExpressLink::Error::category() const
+{
+    switch (code)
+    {
+    case OutOfMemory:
+    case NotConnected:
+    case UnableToConnect:
+        return Transient;
+    case None: // not an error, but never worth a retry
+    case ParseError:
+    case CommandTooLong:
+    case InvalidEscape:
+    case UnknownCommand:
+    case InvalidParameter:
+    case InvalidKeyName:
+    case InvalidTopic:
+    case NotAllowed:
+    case InvalidOTAUpdate:
+        return Permanent;
+    case Timeout:
+        return TimedOut;
+    default:
+        return Unclassified;
+    }
+}
+
+/// @brief Gets the error of the last command, see `error` for the full error line.
+/// @return error code, numeric code and detail; `Error::None` if the last command succeeded
+ExpressLink::Error ExpressLink::lastError() const
+{
+    Error e;
+    e.code = errorCode;
+    e.number = errorNumber;
+    e.detail = error.c_str() + (errorDetail < error.length() ? errorDetail : error.length());
+    return e;
+}
+
+#if EXPRESSLINK_STATISTICS
+const uint16_t ExpressLink::Statistics::BUCKET_LIMITS[] = {1, 4, 16, 64, 256, 1024, 4096};
+
+/// @brief Resets all counters of `statistics()` to 0.
+void ExpressLink::resetStatistics()
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+/// @return true if the `length` bytes of `name` start with `prefix`
+static bool startsWith(const char *name, size_t length, const char *prefix)
+{
+    size_t n = strlen(prefix);
+    return length >= n && strncmp(name, prefix, n) == 0;
+}
+#endif
+
+/// @brief Records the latency, errors and response size of a completed command. Compiles to nothing without `EXPRESSLINK_STATISTICS`.
+/// @param length length of the response line, or -1 if a timeout happened
+void ExpressLink::recordCommand(const Command &command, int length)
+{
+#if EXPRESSLINK_STATISTICS
+    const char *name = command.header[0] != '\0' ? command.header : command.payload; // `cmd()` passes the command as payload
+    size_t n = command.header[0] != '\0' ? strlen(command.header) : command.length;
+    Statistics::CommandType type = Statistics::OtherCommand;
+    if (startsWith(name, n, "SEND"))
+    {
+        type = Statistics::SendCommand;
+    }
+    else if (startsWith(name, n, "GET"))
+    {
+        type = Statistics::GetCommand;
+    }
+    else if (startsWith(name, n, "CONNECT") || startsWith(name, n, "DISCONNECT"))
+    {
+        type = Statistics::ConnectCommand;
+    }
+    else if (startsWith(name, n, "CONF"))
+    {
+        type = Statistics::ConfCommand;
+    }
+    else if (startsWith(name, n, "EVENT"))
+    {
+        type = Statistics::EventCommand;
+    }
+    else if (startsWith(name, n, "SUBSCRIBE") || startsWith(name, n, "UNSUBSCRIBE"))
+    {
+        type = Statistics::SubscribeCommand;
+    }
+    else if (startsWith(name, n, "SHADOW"))
+    {
+        type = Statistics::ShadowCommand;
+    }
+    else if (startsWith(name, n, "OTA"))
+    {
+        type = Statistics::OTACommand;
+    }
+
+    Statistics::Latency &latency = stats.latency[type];
+    uint32_t elapsed = now() - command.started;
+    uint8_t bucket = 0;
+    while (bucket < Statistics::BUCKETS - 1 && elapsed > Statistics::BUCKET_LIMITS[bucket])
+    {
+        bucket++;
+    }
+    latency.count++;
+    latency.histogram[bucket]++;
+    if (elapsed > latency.max)
+    {
+        latency.max = elapsed;
+    }
+
+    if (length < 0)
+    {
+        stats.timeouts++;
+    }
+    else if (errorCode != Error::None)
+    {
+        stats.errors[errorCode - Error::Unrecognized]++;
+    }
+    if (length > 0 && (uint32_t)length > stats.maxResponse)
+    {
+        stats.maxResponse = length;
+    }
+#endif
+}
+
+/// @brief Counts a received event. Compiles to nothing without `EXPRESSLINK_STATISTICS`.
+void ExpressLink::recordEvent(EventCode code)
+{
+#if EXPRESSLINK_STATISTICS
+    stats.events[(code >= FIRST_EVENT_CODE && code < LAST_EVENT_CODE) ? code : 0]++;
+#endif
+}
+
+/// @brief Moves all bytes available on the UART into the receive ring buffer, in as few reads as possible.
+void ExpressLink::fill()
+{
+    int available;
+    while (rxCount < sizeof(rx) && (available = uart->available()) > 0)
+    {
+        size_t end = (rxHead + rxCount) % sizeof(rx);
+        size_t space = (end >= rxHead) ? sizeof(rx) - end : rxHead - end; // contiguous free space
+        if (space > (size_t)available)
+        {
+            space = available;
+        }
+        size_t n = uart->readBytes(rx + end, space);
+        if (n == 0)
+        {
+            break;
+        }
+        rxCount += n;
+#if EXPRESSLINK_STATISTICS
+        stats.bytesReceived += n;
+#endif
+    }
+}
+
+/// @brief Returns the next contiguous run of buffered bytes, refilling the ring buffer from the UART if it is empty.
+/// @param segment set to the first buffered byte
+/// @param eol set to true if the run ends with an EOL
+/// @return number of bytes in the run, up to and including the first EOL; 0 if nothing is available
+size_t ExpressLink::buffered(const uint8_t *&segment, bool &eol)
+{
+    if (rxCount == 0)
+    {
+        fill();
+    }
+    size_t contiguous = sizeof(rx) - rxHead;
+    if (contiguous > rxCount)
+    {
+        contiguous = rxCount;
+    }
+    segment = rx + rxHead;
+    const uint8_t *end = (const uint8_t *)memchr(segment, '\n', contiguous);
+    eol = end != nullptr;
+    return eol ? end - segment + 1 : contiguous;
+}
+
+/// @brief Drops `count` bytes from the front of the receive ring buffer.
+void ExpressLink::consume(size_t count)
+{
+    rxHead = (rxHead + count) % sizeof(rx);
+    rxCount -= count;
+}
+
+/// @brief Copies the status prefix of a streamed response line into the line buffer, until a space ends an `OK` or
+/// `OK{n}` prefix and the rest of the line is streamed, or the line turns out to be no `OK` response.
+/// @return number of bytes of `data` copied
+size_t ExpressLink::receivePrefix(const char *data, size_t length)
+{
+    size_t i = 0;
+    while (i < length && streamState == StreamPrefix)
+    {
+        char c = data[i++];
+        line[received++] = c;
+        if (c == ' ' && received > 2)
+        {
+            streamState = StreamOn;
+        }
+        else if ((received > 2 ? !isDigit(c) : c != "OK"[received - 1]) || received >= 16)
+        {
+            streamState = StreamOff; // e.g., an `ERR` response, received into the line buffer as usual
+        }
+    }
+    return i;
+}
+
+/// @brief Unescapes `length` bytes of a streamed response line on the fly and passes them to the sink, in runs without
+/// escape sequences. Unescaped `\r` bytes are part of the EOL and dropped.
+void ExpressLink::stream(const char *data, size_t length)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = data[i];
+        if (streamEscape)
+        {
+            // see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-delimiters
+            char unescaped = (c == 'A') ? '\n' : (c == 'D') ? '\r' : c;
+            streamEscape = false;
+            if (!emit(&unescaped, 1))
+            {
+                return;
+            }
+            start = i + 1;
+        }
+        else if (c == '\\' || c == '\r')
+        {
+            if (!emit(data + start, i - start))
+            {
+                return;
+            }
+            streamEscape = c == '\\';
+            start = i + 1;
+        }
+    }
+    emit(data + start, length - start);
 }
 
-/// @brief Execute AT command and reads all response lines. Escaping and unescaping is handled automatically. Check class attribute `response` (if true returned) and `error` (if false returned).
-/// @param command: e.g., AT+CONNECT or SUBSCRIBE1 (with or without the `AT+` prefix)
-/// @return true on success, false on error
-bool ExpressLink::cmd(String command)
+/// @brief Passes a fragment of the streamed line to the sink.
+/// @return false if the rest of the line is discarded
+bool ExpressLink::emit(const char *data, size_t length)
 {
-    escape(command);
-    if (!command.startsWith("AT+"))
+    if (streamState != StreamOn)
     {
-        command = "AT+" + command;
+        return false;
     }
-
-    if (debug)
+    if (length > 0 && !streamSink(data, length, false, streamContext))
     {
-        Serial.println("> " + command);
+        streamState = StreamDiscard;
+        return false;
     }
-    uart->print(command + "\n");
-
-    response = readLine();
+    return true;
+}
 
-    if (debug)
+/// @brief Consumes buffered UART bytes without blocking until a full line was received, then unescapes it in-place and trims whitespace.
+/// Bytes exceeding `EXPRESSLINK_MAX_LINE` are discarded. While a sink is set, see `cmdStream()`, the line after its
+/// status prefix is passed to the sink instead.
+/// @return length of the line, or -1 if no full line is available yet
+int ExpressLink::receiveLine()
+{
+    const uint8_t *segment;
+    bool eol = false;
+    size_t n;
+    while (!eol && (n = buffered(segment, eol)) > 0)
     {
-        Serial.println("< " + response);
+        const char *data = (const char *)segment;
+        size_t copy = eol ? n - 1 : n;
+        if (streamState == StreamPrefix)
+        {
+            size_t prefix = receivePrefix(data, copy);
+            data += prefix;
+            copy -= prefix;
+        }
+        if (streamState == StreamOn || streamState == StreamDiscard)
+        {
+            stream(data, copy);
+            consume(n);
+            continue;
+        }
+        if (copy > sizeof(line) - 1 - received)
+        {
+            copy = sizeof(line) - 1 - received;
+            dropping = true;
+        }
+        memcpy(line + received, data, copy);
+        received += copy;
+        consume(n);
     }
-
-    additionalLines = 0;
-    if (response.startsWith("OK "))
+    if (!eol)
     {
-        response = response.substring(3); // trim off the `OK ` prefix
-        error = "";
-        return true;
+        return -1;
     }
-    else if (response.startsWith("OK"))
+    if (streamState == StreamOn)
     {
-        response = response.substring(2); // trim off the `OK` prefix
-        if (response.length() > 0)
-        {
-            String l;
-            for (auto &&c : response)
-            {
-                if (isDigit(c))
-                {
-                    l += c;
-                }
-                else
-                {
-                    break;
-                }
-            }
-            additionalLines = l.toInt();
-            response = response.substring(l.length() + 1); // trim off the number
-        }
-        error = "";
-        return true;
+        streamSink("", 0, true, streamContext);
     }
-    else if (response.startsWith("ERR"))
+    streamState = StreamOff;
+
+    // unescape in-place, see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-delimiters
+    size_t length = unescapeInPlace(line, received);
+    received = 0;
+    truncated = dropping;
+    dropping = false;
+
+    // trim whitespace
+    while (length > 0 && isspace((unsigned char)line[length - 1]))
     {
-        error = response;
-        response = "";
-        return false;
+        length--;
     }
-    else
+    size_t skip = 0;
+    while (skip < length && isspace((unsigned char)line[skip]))
     {
-        error = response;
-        response = "";
-        return false;
+        skip++;
     }
+    memmove(line, line + skip, length - skip);
+    length -= skip;
+    line[length] = '\0';
+    return length;
+}
+
+/// @brief Reads a single response line into the line buffer, see `receiveLine()`.
+/// @param timeout maximum time to wait in milliseconds, 0 to use `setTimeout()`
+/// @return length of the line, or -1 if a UART timeout happened
+int ExpressLink::readResponse(uint32_t timeout)
+{
+    unsigned long start = now();
+    unsigned long limit = timeout ? timeout : this->timeout;
+    do
+    {
+        int length = receiveLine();
+        if (length >= 0)
+        {
+            return length;
+        }
+        idle(nullptr, start);
+    } while (now() - start < limit);
+
+    line[0] = '\0';
+    return -1;
 }
 
 /// @brief equivalent to sending AT and checking for OK response line
@@ -333,8 +2001,7 @@ bool ExpressLink::cmd(String command)
 bool ExpressLink::selfTest()
 {
     uart->print("AT\n");
-    auto response = readLine();
-    return response == "OK";
+    return readResponse() >= 0 && strcmp(line, "OK") == 0;
 }
 
 /// @brief equivalent to: AT+CONNECT or AT+CONNECT!
@@ -344,11 +2011,13 @@ bool ExpressLink::connect(bool async)
 {
     if (async)
     {
-        return cmd("CONNECT!");
+        return cmd("CONNECT!"); // the CONNECT event updates the tracked status
     }
     else
     {
-        return cmd("CONNECT");
+        bool success = executeWithRetry("CONNECT", "", 0, TIMEOUT);
+        trackConnection(success);
+        return success;
     }
 }
 
@@ -356,31 +2025,61 @@ bool ExpressLink::connect(bool async)
 /// @return true if connected, false if disconnected
 bool ExpressLink::isConnected()
 {
-    // OK {status} {onboarded} [CONNECTED/DISCONNECTED] [STAGING/CUSTOMER]
-    cmd("CONNECT?");
-    return response.substring(0, 1) == "1";
+    return connectionStatus().connected;
 }
 
 /// @brief equivalent to: AT+CONNECT? and parsing the response for STAGING/CUSTOMER
 /// @return true if onboarded to customer endpoint, false if staging endpoint
 bool ExpressLink::isOnboarded()
+{
+    return connectionStatus().onboarded;
+}
+
+/// @brief equivalent to: AT+CONNECT? and parsing the full response in a single round-trip.
+/// Also updates `lastConnectionStatus()`.
+/// @return connection state, the previously tracked state if the command failed
+ExpressLink::ConnectionStatus ExpressLink::connectionStatus()
 {
     // OK {status} {onboarded} [CONNECTED/DISCONNECTED] [STAGING/CUSTOMER]
-    cmd("CONNECT?");
-    return response.substring(2, 3) == "1";
+    if (cmd("CONNECT?"))
+    {
+        char *next;
+        connection.connected = strtol(result, &next, 10) == 1;
+        connection.onboarded = strtol(next, nullptr, 10) == 1;
+        connection.updated = now();
+    }
+    return connection;
+}
+
+/// @brief Updates the tracked connection state, keeping the last known endpoint.
+void ExpressLink::trackConnection(bool connected)
+{
+    if (LOG_ENABLED(LogInfo) && connected != connection.connected)
+    {
+        log(LogInfo, connected ? "* connected\n" : "* disconnected\n");
+    }
+    connection.connected = connected;
+    connection.updated = now();
 }
 
 /// @brief equivalent to: AT+DISCONNECT
 /// @return true on success, false on error
 bool ExpressLink::disconnect()
 {
-    return cmd("DISCONNECT");
+    if (!cmd("DISCONNECT"))
+    {
+        return false;
+    }
+    trackConnection(false);
+    return true;
 }
 
 /// @brief soft-reboot of the module, equivalent to: AT+RESET
 /// @return true on success, false on error
 bool ExpressLink::reset()
 {
+    config.invalidate();
+    trackConnection(false);
     return cmd("RESET");
 }
 
@@ -388,6 +2087,8 @@ bool ExpressLink::reset()
 /// @return true on success, false on error
 bool ExpressLink::factoryReset()
 {
+    config.invalidate();
+    trackConnection(false);
     return cmd("FACTORY_RESET");
 }
 
@@ -400,12 +2101,13 @@ ExpressLink::Event ExpressLink::getEvent(bool checkPin)
     //   OK [{event_identifier} {parameter} {mnemonic [detail]}]{EOL}
 
     Event event;
-    if (checkPin && eventPin >= 0 && digitalRead(eventPin) == LOW)
+    if (checkPin && !eventPending())
     {
         event.code = NONE;
         event.parameter = 0;
         return event;
     }
+    eventSignaled = false; // cleared before reading, so an event raised meanwhile is not lost
     if (!cmd("EVENT?"))
     {
         event.code = UNKNOWN;
@@ -420,27 +2122,122 @@ ExpressLink::Event ExpressLink::getEvent(bool checkPin)
     }
 
     char *next;
-    auto code = strtol(response.c_str(), &next, 10);
+    auto code = strtol(result, &next, 10);
     if (code >= FIRST_EVENT_CODE && code < LAST_EVENT_CODE)
     {
-        event.code = EventCode(strtol(response.c_str(), &next, 10));
+        event.code = EventCode(code);
+        if (event.code == STARTUP || event.code == CONFMODE)
+        {
+            config.invalidate(); // configuration may have changed
+        }
     }
     else
     {
         event.code = UNKNOWN;
         event.parameter = 0;
+        recordEvent(event.code);
         return event;
     }
+    recordEvent(event.code);
 
     char *rest;
     event.parameter = strtol(next, &rest, 10);
 
-    response = String(rest);
-    response = response.substring(response.indexOf(' ')); // make optional `detail` available
+    if (event.code == CONNECT)
+    {
+        trackConnection(event.parameter == 0); // connection hint 0 means success
+    }
+    else if (event.code == CONLOST || event.code == STARTUP)
+    {
+        trackConnection(false);
+    }
+
+    const char *detail = strchr(rest, ' ');
+    response = detail ? detail : ""; // make optional `detail` available
 
     return event;
 }
 
+volatile bool ExpressLink::eventSignaled = false;
+
+void ExpressLink::onEventInterrupt()
+{
+    eventSignaled = true;
+}
+
+/// @brief Checks whether the module has events pending, without any UART communication.
+/// Uses the interrupt flag (see `begin()`) and the level of the EVENT pin.
+/// @return true if events are pending, or if no EVENT pin is connected and `AT+EVENT?` needs to be used
+bool ExpressLink::eventPending()
+{
+    if (eventPin < 0)
+    {
+        return true;
+    }
+    return eventSignaled || digitalRead(eventPin) == HIGH;
+}
+
+/// @brief Registers a handler for an event code, to be called from `processEvents()`.
+/// @param code event code to handle, or `UNKNOWN` for events without a registered handler and unparsable events
+/// @param handler function to call, nullptr to remove the handler
+/// @param context passed to each `handler` call
+void ExpressLink::onEvent(EventCode code, EventHandler handler, void *context)
+{
+    int index = (code == UNKNOWN) ? 0 : code;
+    if (index >= 0 && index < LAST_EVENT_CODE)
+    {
+        eventHandlers[index] = handler;
+        eventContexts[index] = context;
+    }
+}
+
+/// @brief Drains pending events and dispatches each one to the handler registered with `onEvent()`.
+///
+/// Issues `AT+EVENT?` repeatedly while the EVENT pin stays asserted (or, without EVENT pin, until the queue is empty).
+/// @param maxEvents maximum number of events to process, 0 (default) for no limit
+/// @param budget maximum time to spend in milliseconds, 0 (default) for no limit
+/// @return number of events processed
+uint16_t ExpressLink::processEvents(uint16_t maxEvents, uint32_t budget)
+{
+    unsigned long start = now();
+    uint16_t count = 0;
+    while ((maxEvents == 0 || count < maxEvents) && (budget == 0 || now() - start < budget))
+    {
+        Event event = getEvent(true);
+        if (event.code == NONE || (event.code == UNKNOWN && result[0] == '\0'))
+        {
+            break; // queue is empty, or EVENT? failed
+        }
+        count++;
+
+        // `response` is ` {mnemonic} [detail]` for known events, see getEvent()
+        const char *detail = response.c_str();
+        if (event.code != UNKNOWN)
+        {
+            while (*detail == ' ')
+            {
+                detail++;
+            }
+            while (*detail != '\0' && *detail != ' ')
+            {
+                detail++;
+            }
+            while (*detail == ' ')
+            {
+                detail++;
+            }
+        }
+
+        int index = (event.code == UNKNOWN || eventHandlers[event.code] == nullptr) ? 0 : event.code;
+        if (eventHandlers[index] != nullptr)
+        {
+            eventHandlers[index](*this, event, detail, eventContexts[index]);
+        }
+    }
+    return count;
+}
+
+#if !EXPRESSLINK_STATIC
 /// @brief Subscribe to Topic#.
 ///
 /// Equivalent to `AT+CONF Topic{topic_index}={topic_name}` followed by `AT+SUBSCRIBE{topic_index}`.
@@ -449,11 +2246,23 @@ ExpressLink::Event ExpressLink::getEvent(bool checkPin)
 /// @return true on success, false on error
 bool ExpressLink::subscribe(uint8_t topic_index, String topic_name)
 {
-    if (topic_name.length() > 0)
+    return subscribe(topic_index, topic_name.c_str());
+}
+#endif
+
+/// @brief Same as `ExpressLink::subscribe(uint8_t, String)`, without any heap allocations.
+/// @param topic_index index to subscribe to
+/// @param topic_name null-terminated name of topic (empty to skip setting topic in configuration dictionary)
+/// @return true on success, false on error
+bool ExpressLink::subscribe(uint8_t topic_index, const char *topic_name)
+{
+    if (*topic_name != '\0')
     {
         config.setTopic(topic_index, topic_name);
     }
-    return cmd("SUBSCRIBE" + String(topic_index));
+    char command[16];
+    snprintf(command, sizeof(command), "SUBSCRIBE%u", topic_index);
+    return executeWithRetry(command);
 }
 
 /// @brief Unsubscribe from Topic#.
@@ -463,7 +2272,9 @@ bool ExpressLink::subscribe(uint8_t topic_index, String topic_name)
 /// @return true on success, false on error
 bool ExpressLink::unsubscribe(uint8_t topic_index)
 {
-    return cmd("UNSUBSCRIBE" + String(topic_index));
+    char command[16];
+    snprintf(command, sizeof(command), "UNSUBSCRIBE%u", topic_index);
+    return cmd(command);
 }
 
 /// @brief Request next message pending on the indicated topic.
@@ -473,9 +2284,105 @@ bool ExpressLink::unsubscribe(uint8_t topic_index)
 /// @return true on success, false on error
 bool ExpressLink::get(uint8_t topic_index)
 {
-    return cmd("GET" + String(topic_index));
+    if (topic_index == (uint8_t)-1)
+    {
+        return cmd("GET");
+    }
+    char command[8];
+    snprintf(command, sizeof(command), "GET%u", topic_index);
+    return cmd(command);
+}
+
+/// @brief Copies the null-terminated `value` into `destination`, truncating it if needed.
+/// @return number of bytes copied, excluding the null-terminator
+static size_t copyString(char *destination, size_t capacity, const char *value, bool &truncated)
+{
+    if (capacity == 0)
+    {
+        truncated = truncated || *value != '\0';
+        return 0;
+    }
+    size_t length = strlen(value);
+    if (length >= capacity)
+    {
+        length = capacity - 1;
+        truncated = true;
+    }
+    memcpy(destination, value, length);
+    destination[length] = '\0';
+    return length;
+}
+
+/// @brief Receives the next message pending on the indicated topic into a caller-supplied buffer.
+///
+/// Equivalent to `AT+GET{topic_index}`. For `GET` and `GET0` the topic name is stored in front of the payload.
+/// @param topic_index use -1 for `GET`, or value for `GETx`
+/// @param message set to the received topic and payload
+/// @param buffer storage for the topic name and payload
+/// @param size capacity of `buffer` in bytes
+/// @return true if a message was received, false if no message was pending or on error (check `error`)
+bool ExpressLink::receive(uint8_t topic_index, Message &message, char *buffer, size_t size)
+{
+    message.topic_index = topic_index;
+    message.topic = "";
+    message.payload = "";
+    message.length = 0;
+    message.truncated = false;
+
+    if (!get(topic_index))
+    {
+        return false;
+    }
+    const char *payload = result;
+    size_t used = 0;
+    if (additionalLines > 0)
+    {
+        // OK1 {topic}{EOL}{message}{EOL}
+        message.truncated = truncated;
+        used = copyString(buffer, size, result, message.truncated) + 1;
+        message.topic = buffer;
+        if (readResponse() < 0)
+        {
+            return false;
+        }
+        pendingLines--;
+        payload = line;
+    }
+    else if (*payload == '\0')
+    {
+        return false; // no message pending
+    }
+    message.truncated = message.truncated || truncated;
+    if (used > size)
+    {
+        used = size;
+    }
+    message.length = copyString(buffer + used, size - used, payload, message.truncated);
+    message.payload = (used < size) ? buffer + used : "";
+    return true;
+}
+
+/// @brief Receives all messages pending on the indicated topic, by repeating `AT+GET{topic_index}` until the queue is empty.
+/// @param topic_index use -1 for `GET`, or value for `GETx`
+/// @param buffer storage for the topic name and payload, reused for every message
+/// @param size capacity of `buffer` in bytes
+/// @param handler called for every received message
+/// @param context passed to each `handler` call
+/// @param maxMessages maximum number of messages to receive, 0 (default) for no limit
+/// @return number of messages received
+uint16_t ExpressLink::drain(uint8_t topic_index, char *buffer, size_t size, MessageHandler handler, void *context, uint16_t maxMessages)
+{
+    uint16_t count = 0;
+    Message message;
+    while ((maxMessages == 0 || count < maxMessages) && receive(topic_index, message, buffer, size))
+    {
+        count++;
+        handler(*this, message, context);
+    }
+    return count;
 }
 
+#if !EXPRESSLINK_STATIC
 /// @brief Same as `ExpressLink::publish - use it instead.`
 /// @param topic_index
 /// @param message
@@ -493,7 +2400,85 @@ bool ExpressLink::send(uint8_t topic_index, String message)
 /// @return true on success, false on error
 bool ExpressLink::publish(uint8_t topic_index, String message)
 {
-    return cmd("SEND" + String(topic_index) + " " + message);
+    return publish(topic_index, message.c_str(), message.length());
+}
+#endif
+
+/// @brief Same as `ExpressLink::publish - use it instead.`
+/// @param topic_index
+/// @param message
+/// @return true on success, false on error
+bool ExpressLink::send(uint8_t topic_index, const char *message)
+{
+    return publish(topic_index, message);
+}
+
+/// @brief Same as `ExpressLink::publish(uint8_t, String)`, without any heap allocations.
+/// @param topic_index the topic index to publish to
+/// @param message null-terminated raw message to publish, typically JSON-encoded
+/// @return true on success, false on error
+bool ExpressLink::publish(uint8_t topic_index, const char *message)
+{
+    return publish(topic_index, message, strlen(message));
+}
+
+/// @brief Same as `ExpressLink::publish(uint8_t, String)`, without any heap allocations.
+/// @param topic_index the topic index to publish to
+/// @param message raw message to publish, typically JSON-encoded
+/// @param length number of bytes in `message`
+/// @return true on success, false on error
+bool ExpressLink::publish(uint8_t topic_index, const char *message, size_t length)
+{
+    char header[12];
+    snprintf(header, sizeof(header), "SEND%u ", topic_index);
+    return executeWithRetry(header, message, length);
+}
+
+/// @brief Same as `ExpressLink::publish(uint8_t, String)`, for binary or non-terminated payloads.
+/// @param topic_index the topic index to publish to
+/// @param message raw message to publish
+/// @param length number of bytes in `message`
+/// @return true on success, false on error
+bool ExpressLink::publish(uint8_t topic_index, const uint8_t *message, size_t length)
+{
+    return publish(topic_index, (const char *)message, length);
+}
+
+/// @brief Reads the next chunk of a `Stream` payload, see `Command::Producer`.
+static size_t readStream(uint8_t *buffer, size_t size, void *context)
+{
+    Stream *stream = (Stream *)context;
+    int available = stream->available();
+    if (available <= 0)
+    {
+        return 0;
+    }
+    return stream->readBytes(buffer, (size_t)available < size ? available : size);
+}
+
+/// @brief Publish all bytes available from `message`, e.g., a file. The payload is escaped and written to the UART chunk by chunk, without buffering the whole message.
+///
+/// Equivalent to `AT+SEND{topic_index} {message}`.
+/// @param topic_index the topic index to publish to
+/// @param message stream to read the raw message from, until `available()` returns 0
+/// @return true on success, false on error
+bool ExpressLink::publish(uint8_t topic_index, Stream &message)
+{
+    return publish(topic_index, readStream, &message);
+}
+
+/// @brief Publish a message generated chunk by chunk, e.g., by a serializer. Each chunk is escaped and written to the UART as soon as it is produced.
+///
+/// Equivalent to `AT+SEND{topic_index} {message}`.
+/// @param topic_index the topic index to publish to
+/// @param producer called repeatedly to fill a small buffer with the next chunk, until it returns 0
+/// @param context passed to each `producer` call
+/// @return true on success, false on error
+bool ExpressLink::publish(uint8_t topic_index, Command::Producer producer, void *context)
+{
+    char header[12];
+    snprintf(header, sizeof(header), "SEND%u ", topic_index);
+    return executeProduced(header, producer, context);
 }
 
 /// @brief Fetches the current state of the OTA process.
@@ -507,7 +2492,7 @@ ExpressLink::OTAState ExpressLink::otaGetState()
     s.code = OTACode(response.charAt(0) - '0'); // get numerical digit value from string character
     if (response.length() > 2)
     {
-        s.detail = String(response.substring(2));
+        s.detail = response.c_str() + 2;
     }
     else
     {
@@ -534,7 +2519,9 @@ bool ExpressLink::otaAccept()
 /// @return true on success, false on error
 bool ExpressLink::otaRead(uint32_t count)
 {
-    return cmd("OTA READ " + String(count));
+    char command[24];
+    snprintf(command, sizeof(command), "OTA READ %lu", (unsigned long)count);
+    return cmd(command);
 }
 
 /// @brief Moves the read pointer to an absolute address.
@@ -550,7 +2537,9 @@ bool ExpressLink::otaSeek(uint32_t address)
     }
     else
     {
-        return cmd("OTA SEEK " + String(address));
+        char command[24];
+        snprintf(command, sizeof(command), "OTA SEEK %lu", (unsigned long)address);
+        return cmd(command);
     }
 }
 
@@ -581,6 +2570,151 @@ bool ExpressLink::otaFlush()
     return cmd("OTA FLUSH");
 }
 
+/// @return value of the hexadecimal digit `c`, or -1
+int ExpressLink::hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20; // lowercase
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+/// @brief Parses an `OTA READ` response `{count} {data}{checksum}` and decodes the hexadecimal data into `destination`.
+/// The checksum (16-bit sum of the data bytes) is verified if present.
+/// @return number of decoded bytes, or -1 if the response is malformed
+static long decodeOTAChunk(const char *response, uint8_t *destination)
+{
+    char *p;
+    unsigned long count = strtoul(response, &p, 16);
+    if (p == response)
+    {
+        return -1;
+    }
+    while (*p == ' ')
+    {
+        p++;
+    }
+    uint16_t sum = 0;
+    for (unsigned long i = 0; i < count; i++)
+    {
+        int high = ExpressLink::hexValue(p[0]);
+        int low = (high >= 0) ? ExpressLink::hexValue(p[1]) : -1;
+        if (low < 0)
+        {
+            return -1;
+        }
+        destination[i] = (uint8_t)(high << 4 | low);
+        sum += destination[i];
+        p += 2;
+    }
+    while (*p == ' ')
+    {
+        p++;
+    }
+    if (*p != '\0' && strtoul(p, nullptr, 16) != sum)
+    {
+        return -1;
+    }
+    return count;
+}
+
+/// @brief Downloads the host OTA image chunk by chunk and streams each chunk directly into `sink`.
+///
+/// Repeats `AT+OTA READ {chunkSize}` until the module returns no more data. Each response is decoded in-place in the
+/// line buffer, without copying it into `response`. A chunk that fails to be read or verified is read again after
+/// `AT+OTA SEEK {offset}`, up to `OTA_RETRIES` times in a row.
+///
+/// With `pipelined`, the next `OTA READ` is sent before `sink` is called, so the module prepares the next chunk while
+/// the host writes the current one. Its response is then buffered by the UART driver until the sink returns, so chunks
+/// are limited to fit into `EXPRESSLINK_UART_BUFFER`, e.g., 22 bytes with the 64 byte buffer of an AVR.
+/// @param sink called with every decoded chunk and its offset in the image
+/// @param context passed to each `sink` call
+/// @param chunkSize bytes per `OTA READ`, 0 (default) for the largest chunk that fits into `EXPRESSLINK_MAX_LINE`
+/// @param offset image offset to resume from, e.g., `OTADownload::size` of an aborted download
+/// @param pipelined overlap reading the next chunk with processing the current one, off by default
+/// @return download result with size, checksum and throughput
+ExpressLink::OTADownload ExpressLink::otaDownload(OTASink sink, void *context, uint32_t chunkSize, uint32_t offset, bool pipelined)
+{
+    // a response is `OK {count} {data} {checksum}\r\n`, with two hexadecimal digits per byte
+    const uint32_t maxChunkSize = ((pipelined ? EXPRESSLINK_UART_BUFFER : sizeof(line)) - 20) / 2;
+    if (chunkSize == 0 || chunkSize > maxChunkSize)
+    {
+        chunkSize = maxChunkSize;
+    }
+    char command[24];
+    snprintf(command, sizeof(command), "OTA READ %lu", (unsigned long)chunkSize);
+
+    OTADownload download = {false, offset, 0, 0, 0};
+    unsigned long start = now();
+    Command reads[2];
+    uint8_t current = 0;
+    bool inFlight = false; // reads[current] was already sent by the pipeline
+    bool seek = offset > 0;
+    uint8_t failures = 0;
+    while (true)
+    {
+        Command &read = reads[current];
+        if (!inFlight)
+        {
+            if (seek && !otaSeek(download.size))
+            {
+                break;
+            }
+            seek = false;
+            prepare(read, command, "", 0);
+            read.raw = true;
+            enqueue(read);
+        }
+        inFlight = false;
+
+        long length = wait(read) ? decodeOTAChunk(result, (uint8_t *)line) : -1;
+        if (length < 0)
+        {
+            if (++failures > OTA_RETRIES)
+            {
+                break;
+            }
+            download.retries++;
+            seek = true;
+            continue;
+        }
+        failures = 0;
+        if (length == 0)
+        {
+            download.success = true;
+            break;
+        }
+
+        if (pipelined)
+        {
+            current ^= 1;
+            prepare(reads[current], command, "", 0);
+            reads[current].raw = true;
+            enqueue(reads[current]);
+            poll(); // transmit only, the response line is received after the sink returned
+            inFlight = true;
+        }
+
+        if (!sink(download.size, (const uint8_t *)line, length, context))
+        {
+            if (inFlight)
+            {
+                wait(reads[current]);
+            }
+            break;
+        }
+        download.size += length;
+        for (long i = 0; i < length; i++)
+        {
+            download.checksum += (uint8_t)line[i];
+        }
+    }
+    download.elapsed = now() - start;
+    return download;
+}
+
 /// @brief Initialize communication with the Device Shadow service.
 ///
 /// Equivalent to `AT+SHADOW{index} INIT<EOL>`.
@@ -588,8 +2722,7 @@ bool ExpressLink::otaFlush()
 /// @return true on success, false on error
 bool ExpressLink::shadowInit(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " INIT");
+    return shadow(index, "INIT");
 }
 
 /// @brief Request a Device Shadow document.
@@ -599,8 +2732,7 @@ bool ExpressLink::shadowInit(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowDoc(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " DOC");
+    return shadow(index, "DOC");
 }
 
 /// @brief Retrieve a device shadow document.
@@ -610,10 +2742,10 @@ bool ExpressLink::shadowDoc(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowGetDoc(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " GET DOC");
+    return shadow(index, "GET DOC");
 }
 
+#if !EXPRESSLINK_STATIC
 /// @brief Request a device shadow document update.
 ///
 /// Equivalent to `AT+SHADOW{index} UPDATE {new_state}<EOL>`.
@@ -621,8 +2753,27 @@ bool ExpressLink::shadowGetDoc(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowUpdate(String new_state, uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " UPDATE " + new_state);
+    return shadow(index, "UPDATE ", new_state.c_str(), new_state.length());
+}
+#endif
+
+/// @brief Same as `ExpressLink::shadowUpdate(String, uint8_t)`, without any heap allocations.
+/// @param new_state null-terminated JSON state document
+/// @param index shadow index. Use -1 (default), to select the unnamed shadow.
+/// @return true on success, false on error
+bool ExpressLink::shadowUpdate(const char *new_state, uint8_t index)
+{
+    return shadow(index, "UPDATE ", new_state, strlen(new_state));
+}
+
+/// @brief Same as `ExpressLink::shadowUpdate(String, uint8_t)`, without any heap allocations.
+/// @param new_state JSON state document
+/// @param length number of bytes in `new_state`
+/// @param index shadow index. Use -1 to select the unnamed shadow.
+/// @return true on success, false on error
+bool ExpressLink::shadowUpdate(const char *new_state, size_t length, uint8_t index)
+{
+    return shadow(index, "UPDATE ", new_state, length);
 }
 
 /// @brief Retrieve a device shadow update response.
@@ -632,8 +2783,7 @@ bool ExpressLink::shadowUpdate(String new_state, uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowGetUpdate(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " GET UPDATE");
+    return shadow(index, "GET UPDATE");
 }
 
 /// @brief Subscribe to a device shadow document.
@@ -643,8 +2793,7 @@ bool ExpressLink::shadowGetUpdate(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowSubscribe(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " SUBSCRIBE");
+    return shadow(index, "SUBSCRIBE");
 }
 
 /// @brief Unsubscribe from a device shadow document.
@@ -654,8 +2803,7 @@ bool ExpressLink::shadowSubscribe(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowUnsubscribe(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " UNSUBSCRIBE");
+    return shadow(index, "UNSUBSCRIBE");
 }
 
 /// @brief Retrieve a Shadow Delta message.
@@ -665,8 +2813,7 @@ bool ExpressLink::shadowUnsubscribe(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowGetDelta(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " GET DELTA");
+    return shadow(index, "GET DELTA");
 }
 
 /// @brief Request the deletion of a Shadow document.
@@ -676,8 +2823,7 @@ bool ExpressLink::shadowGetDelta(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowDelete(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " DELETE");
+    return shadow(index, "DELETE");
 }
 
 /// @brief Request a Shadow delete response.
@@ -687,8 +2833,36 @@ bool ExpressLink::shadowDelete(uint8_t index)
 /// @return true on success, false on error
 bool ExpressLink::shadowGetDelete(uint8_t index)
 {
-    String i = (index >= 0) ? String(index) : "";
-    return cmd("SHADOW" + i + " GET DELETE");
+    return shadow(index, "GET DELETE");
+}
+
+/// @brief Formats and executes `AT+SHADOW{index} {command}{payload}`.
+/// @param index shadow index. Use -1 to select the unnamed shadow.
+bool ExpressLink::shadow(uint8_t index, const char *command, const char *payload, size_t length)
+{
+    char header[32];
+    if (!shadowHeader(header, sizeof(header), index, command))
+    {
+        return rejectCommand("command too long");
+    }
+    return executeWithRetry(header, payload, length);
+}
+
+/// @brief Formats the command header `SHADOW{index} {command}`, or `SHADOW {command}` for the unnamed shadow.
+/// @param index shadow index, -1 for the unnamed shadow
+/// @return false if the header does not fit into `size` bytes
+bool ExpressLink::shadowHeader(char *header, size_t size, uint8_t index, const char *command)
+{
+    int n;
+    if (index == (uint8_t)-1)
+    {
+        n = snprintf(header, size, "SHADOW %s", command);
+    }
+    else
+    {
+        n = snprintf(header, size, "SHADOW%u %s", index, command);
+    }
+    return n >= 0 && (size_t)n < size;
 }
 
 /// @brief Enters Serial/UART passthrough mode.
@@ -697,6 +2871,9 @@ bool ExpressLink::shadowGetDelete(uint8_t index)
 void ExpressLink::passthrough(Stream *destination)
 {
     // inspired by https://docs.arduino.cc/built-in-examples/communication/SerialPassthrough
+    destination->write(rx + rxHead, sizeof(rx) - rxHead < rxCount ? sizeof(rx) - rxHead : rxCount);
+    destination->write(rx, rxHead + rxCount > sizeof(rx) ? rxHead + rxCount - sizeof(rx) : 0);
+    rxCount = 0;
     while (true)
     {
         if (destination->available())
@@ -3,64 +3,278 @@
 #include "Arduino.h"
 #include "Stream.h"
 
+/// @brief Capacity in bytes of the preallocated line buffer used to parse responses.
+/// Longer response lines are truncated, commands are escaped while streaming them to the UART and are not limited.
+/// Override it in your build flags, e.g. `-DEXPRESSLINK_MAX_LINE=4096` for large shadow documents.
+#ifndef EXPRESSLINK_MAX_LINE
+#if defined(__AVR__)
+#define EXPRESSLINK_MAX_LINE 256
+#else
+#define EXPRESSLINK_MAX_LINE 1024
+#endif
+#endif
+
+/// @brief Capacity in bytes of the receive ring buffer, which is filled in blocks from the UART.
+#ifndef EXPRESSLINK_RX_BUFFER
+#if defined(__AVR__)
+#define EXPRESSLINK_RX_BUFFER 64
+#else
+#define EXPRESSLINK_RX_BUFFER 256
+#endif
+#endif
+
+/// @brief Capacity in bytes of the receive buffer of the UART driver, e.g., `SERIAL_RX_BUFFER_SIZE` of `HardwareSerial`.
+/// A pipelined `ExpressLink::otaDownload()` limits its chunks so that a whole response fits into it while the sink runs.
+#ifndef EXPRESSLINK_UART_BUFFER
+#if defined(SERIAL_RX_BUFFER_SIZE)
+#define EXPRESSLINK_UART_BUFFER SERIAL_RX_BUFFER_SIZE
+#elif defined(__AVR__)
+#define EXPRESSLINK_UART_BUFFER 64
+#else
+#define EXPRESSLINK_UART_BUFFER 256
+#endif
+#endif
+
+/// @brief Number of configuration values remembered by the `ExpressLinkConfig` cache, see `ExpressLinkConfig::enableCache()`.
+#ifndef EXPRESSLINK_CONFIG_CACHE
+#define EXPRESSLINK_CONFIG_CACHE 8
+#endif
+
+/// @brief Set to 1 to record `ExpressLink::Statistics`, or to 0 to remove all instrumentation.
+/// Disabled by default on AVR, where the counters would take a significant share of the RAM.
+#ifndef EXPRESSLINK_STATISTICS
+#if defined(__AVR__)
+#define EXPRESSLINK_STATISTICS 0
+#else
+#define EXPRESSLINK_STATISTICS 1
+#endif
+#endif
+
+/// @brief Log levels for `EXPRESSLINK_LOG_LEVEL`, see `ExpressLink::LogLevel`.
+#define EXPRESSLINK_LOG_NONE 0
+#define EXPRESSLINK_LOG_ERROR 1
+#define EXPRESSLINK_LOG_WARNING 2
+#define EXPRESSLINK_LOG_INFO 3
+#define EXPRESSLINK_LOG_DEBUG 4
+
+/// @brief Most verbose log level compiled in, messages of less severe levels compile away.
+/// `EXPRESSLINK_LOG_DEBUG` includes every command and response line, as printed with `begin(..., debug = true)`.
+#ifndef EXPRESSLINK_LOG_LEVEL
+#define EXPRESSLINK_LOG_LEVEL EXPRESSLINK_LOG_DEBUG
+#endif
+
+/// @brief Number of log lines kept in the trace ring buffer for post-mortem dumps, see `ExpressLink::dumpTrace()`.
+/// 0 disables the trace. Opt-in, e.g., with `-DEXPRESSLINK_TRACE=16`: every logged line up to
+/// `EXPRESSLINK_LOG_LEVEL` is then copied into the trace, even without a log sink.
+#ifndef EXPRESSLINK_TRACE
+#define EXPRESSLINK_TRACE 0
+#endif
+
+/// @brief Capacity in bytes of each trace entry, longer log lines are truncated.
+#ifndef EXPRESSLINK_TRACE_LENGTH
+#define EXPRESSLINK_TRACE_LENGTH 48
+#endif
+
+/// @brief Set to 1 to log the payloads of `SEND`, `SHADOW UPDATE`, `CONF` and the other commands with a payload at
+/// `LogDebug`. By default they are logged as `...`, as the payload would be scanned and copied into the trace chunk by
+/// chunk while it is written to the UART. Commands sent with `cmd()` are always logged in full.
+#ifndef EXPRESSLINK_LOG_PAYLOAD
+#define EXPRESSLINK_LOG_PAYLOAD 0
+#endif
+
+/// @brief Set to 1 for a build that never allocates from the heap, e.g., for safety-critical targets.
+///
+/// `ExpressLink::response`, `ExpressLink::error`, the values returned by the `ExpressLinkConfig` getters and
+/// `readLine()`, the configuration cache and `ExpressLink::OTAState::detail` are fixed-capacity `ExpressLinkString`s
+/// instead of `String`s, longer values are truncated. The overloads taking a `String` are removed, use the
+/// `const char *` overloads instead. `ExpressLinkShadow` stores its values in `EXPRESSLINK_SHADOW_VALUE` bytes each.
+///
+/// The storage of an `ExpressLink` instance, including its `ExpressLinkConfig`, is then fixed at compile time, in bytes:
+/// - line buffer and `response`: 2 x `EXPRESSLINK_MAX_LINE`
+/// - `error`: `EXPRESSLINK_MAX_ERROR`
+/// - configuration cache: `EXPRESSLINK_CONFIG_CACHE` x (20 + `EXPRESSLINK_CONFIG_VALUE`)
+/// - receive buffer: `EXPRESSLINK_RX_BUFFER`
+/// - trace, if enabled: `EXPRESSLINK_TRACE` x (4 + `EXPRESSLINK_TRACE_LENGTH`) on 32-bit targets
+/// - statistics: 548 with `EXPRESSLINK_STATISTICS`
+/// - event handlers: 224 on 32-bit targets, plus about 150 for the command queue and other state
+///
+/// E.g., `sizeof(ExpressLink)` on a 64-bit host is 4,480 with `EXPRESSLINK_STATIC` and the defaults, and 2,392 with
+/// `EXPRESSLINK_MAX_LINE=256` and `EXPRESSLINK_STATISTICS=0`. The configuration getters and
+/// `readLine()` return their value on the stack, i.e., `EXPRESSLINK_MAX_LINE` bytes, and `ExpressLink::OTAState` takes
+/// `EXPRESSLINK_OTA_DETAIL` bytes more.
+#ifndef EXPRESSLINK_STATIC
+#define EXPRESSLINK_STATIC 0
+#endif
+
+/// @brief Capacity in bytes of `ExpressLink::error` with `EXPRESSLINK_STATIC`, including the null-terminator.
+/// Longer error lines are truncated.
+#ifndef EXPRESSLINK_MAX_ERROR
+#define EXPRESSLINK_MAX_ERROR 64
+#endif
+
+/// @brief Capacity in bytes of each cached configuration value with `EXPRESSLINK_STATIC`, including the
+/// null-terminator. Longer values are not cached.
+#ifndef EXPRESSLINK_CONFIG_VALUE
+#define EXPRESSLINK_CONFIG_VALUE 64
+#endif
+
+/// @brief Capacity in bytes of `ExpressLink::OTAState::detail` with `EXPRESSLINK_STATIC`, including the
+/// null-terminator. Longer details are truncated.
+#ifndef EXPRESSLINK_OTA_DETAIL
+#define EXPRESSLINK_OTA_DETAIL 64
+#endif
+
+#if EXPRESSLINK_STATIC
+#include "ExpressLinkString.h"
+/// @brief String type of responses and configuration values, see `EXPRESSLINK_STATIC`.
+/// The `ExpressLinkConfig` getters and `readLine()` return it by value, so each call takes `EXPRESSLINK_MAX_LINE` bytes
+/// on the caller's stack. On small stacks, use `ExpressLinkConfig::get()` and `ExpressLink::response` instead.
+typedef ExpressLinkString<EXPRESSLINK_MAX_LINE> ExpressLinkText;
+#else
+/// @brief String type of responses and configuration values, see `EXPRESSLINK_STATIC`.
+typedef String ExpressLinkText;
+#endif
+
 class ExpressLink;
 
 class ExpressLinkConfig
 {
+    friend class ExpressLink;
+
 public:
+    /// @brief Receives a PEM value line by line, see `getPEM()`.
+    /// @param line null-terminated line without EOL, valid until the sink returns
+    /// @return true to continue, false to skip the remaining lines
+    typedef bool (*PEMSink)(const char *line, size_t length, void *context);
+
+    /// @brief Receives the binary (DER) contents of a PEM value chunk by chunk, see `getDER()`.
+    /// @return true to continue, false to skip the rest of the value
+    typedef bool (*DERSink)(const uint8_t *data, size_t length, void *context);
+
     ExpressLinkConfig(ExpressLink &el);
 
+    void enableCache(bool enable = true);
+    void invalidate();
+
+    bool get(const char *key);
+#if !EXPRESSLINK_STATIC
     bool get(String key);
     bool set(String key, String value);
-
-    String getAbout();
-    String getVersion();
-    String getTechSpec();
-    String getThingName();
-    String getCertificate();
-
-    String getCustomName();
+#endif
+    bool set(const char *key, const char *value, size_t length);
+    bool set(const char *key, Stream &value);
+    bool getPEM(const char *key, PEMSink sink, void *context = nullptr);
+    bool getDER(const char *key, DERSink sink, void *context = nullptr);
+
+    // with `EXPRESSLINK_STATIC`, each getter returns `EXPRESSLINK_MAX_LINE` bytes on the stack, see `ExpressLinkText`
+    ExpressLinkText getAbout();
+    ExpressLinkText getVersion();
+    ExpressLinkText getTechSpec();
+    ExpressLinkText getThingName();
+    ExpressLinkText getCertificate();
+    bool getCertificate(PEMSink sink, void *context = nullptr);
+
+    ExpressLinkText getCustomName();
+#if !EXPRESSLINK_STATIC
     bool setCustomName(const String &value);
+#endif
+    bool setCustomName(const char *value);
 
-    String getEndpoint();
+    ExpressLinkText getEndpoint();
+#if !EXPRESSLINK_STATIC
     bool setEndpoint(const String &value);
+#endif
+    bool setEndpoint(const char *value);
 
-    String getRootCA();
+    ExpressLinkText getRootCA();
+    bool getRootCA(PEMSink sink, void *context = nullptr);
+#if !EXPRESSLINK_STATIC
     bool setRootCA(const String &value);
+#endif
+    bool setRootCA(const char *value);
+    bool setRootCA(Stream &value);
 
-    String getShadowToken();
+    ExpressLinkText getShadowToken();
+#if !EXPRESSLINK_STATIC
     bool setShadowToken(const String &value);
+#endif
+    bool setShadowToken(const char *value);
 
     uint32_t getDefenderPeriod();
     bool setDefenderPeriod(const uint32_t value);
 
-    String getHOTAcertificate();
+    ExpressLinkText getHOTAcertificate();
+    bool getHOTAcertificate(PEMSink sink, void *context = nullptr);
+#if !EXPRESSLINK_STATIC
     bool setHOTAcertificate(const String &value);
+#endif
+    bool setHOTAcertificate(const char *value);
+    bool setHOTAcertificate(Stream &value);
 
-    String getOTAcertificate();
+    ExpressLinkText getOTAcertificate();
+    bool getOTAcertificate(PEMSink sink, void *context = nullptr);
+#if !EXPRESSLINK_STATIC
     bool setOTAcertificate(const String &value);
+#endif
+    bool setOTAcertificate(const char *value);
+    bool setOTAcertificate(Stream &value);
 
-    String getSSID();
+    ExpressLinkText getSSID();
+#if !EXPRESSLINK_STATIC
     bool setSSID(const String &value);
+#endif
+    bool setSSID(const char *value);
 
+#if !EXPRESSLINK_STATIC
     bool setPassphrase(const String &value);
+#endif
+    bool setPassphrase(const char *value);
 
-    String getAPN();
+    ExpressLinkText getAPN();
+#if !EXPRESSLINK_STATIC
     bool setAPN(const String &value);
+#endif
+    bool setAPN(const char *value);
 
-    String getTopic(uint8_t index);
+    ExpressLinkText getTopic(uint8_t index);
+#if !EXPRESSLINK_STATIC
     bool setTopic(uint8_t index, String topic);
+#endif
+    bool setTopic(uint8_t index, const char *topic);
 
-    String getShadow(uint8_t index);
+    ExpressLinkText getShadow(uint8_t index);
+#if !EXPRESSLINK_STATIC
     bool setShadow(uint8_t index, String topic);
+#endif
+    bool setShadow(uint8_t index, const char *topic);
 
 private:
+    bool query(const char *key);
+    void store(const char *key, const char *value, size_t length);
+    int lookup(const char *key);
+    void written(const char *command, size_t length);
+    void hit(const char *value);
+
     ExpressLink &expresslink;
+
+    struct CacheEntry
+    {
+        char key[20]; /// empty if unused
+#if EXPRESSLINK_STATIC
+        ExpressLinkString<EXPRESSLINK_CONFIG_VALUE> value;
+#else
+        String value;
+#endif
+    };
+    CacheEntry cache[EXPRESSLINK_CONFIG_CACHE];
+    uint8_t cacheNext = 0;
+    bool caching = false;
 };
 
 class ExpressLink
 {
     friend class ExpressLinkConfig;
+    friend class ExpressLinkPacer;
 
 public:
     /// @brief see https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-event-handling.html#elpg-event-handling-commands
@@ -109,22 +323,307 @@ public:
         int parameter;
     };
 
+    /// @brief Connection state parsed from `AT+CONNECT?`, and tracked from connection commands and events.
+    struct ConnectionStatus
+    {
+        bool connected;
+        bool onboarded;        /// true if using the customer endpoint, false for the staging endpoint
+        unsigned long updated; /// `now()` of the last update, 0 if never updated
+    };
+
+    /// @brief A received message, see `ExpressLink::receive()`. Strings point into the caller-supplied buffer.
+    struct Message
+    {
+        uint8_t topic_index;
+        const char *topic;   /// topic name for `GET` and `GET0`, empty for `GET{n}`
+        const char *payload; /// null-terminated message payload
+        size_t length;       /// number of bytes in `payload`
+        bool truncated;      /// true if the topic or payload did not fit into the buffer or `EXPRESSLINK_MAX_LINE`
+    };
+
+    /// @brief Handles a message received by `ExpressLink::drain()`.
+    typedef void (*MessageHandler)(ExpressLink &expresslink, const Message &message, void *context);
+
+    /// @brief Handles an event dispatched by `ExpressLink::processEvents()`.
+    /// @param detail optional event detail after the mnemonic (e.g., the topic of an `OVERRUN`), or the full event line for `UNKNOWN` events
+    typedef void (*EventHandler)(ExpressLink &expresslink, const Event &event, const char *detail, void *context);
+
     struct OTAState
     {
         OTACode code;
+#if EXPRESSLINK_STATIC
+        ExpressLinkString<EXPRESSLINK_OTA_DETAIL> detail;
+#else
         String detail;
+#endif
+    };
+
+    /// @brief Result of `ExpressLink::otaDownload()`.
+    struct OTADownload
+    {
+        bool success;      /// true if the whole image was delivered to the sink
+        uint32_t size;     /// offset after the last byte delivered to the sink, pass it to `otaDownload()` to resume
+        uint16_t checksum; /// 16-bit sum of all bytes delivered to the sink
+        uint32_t elapsed;  /// duration of the download in milliseconds
+        uint16_t retries;  /// number of chunks read again after an error
+
+        /// @return average throughput in bytes per second
+        uint32_t bytesPerSecond() const { return elapsed ? (uint64_t)size * 1000 / elapsed : 0; }
+    };
+
+    /// @brief Receives host OTA image data from `ExpressLink::otaDownload()`, e.g., to write it to flash.
+    /// @return true to continue, false to abort the download
+    typedef bool (*OTASink)(uint32_t offset, const uint8_t *data, size_t length, void *context);
+
+    /// @brief Error of the last command, parsed from an `ERR{n} {mnemonic} [detail]` response, see `ExpressLink::lastError()`.
+    /// See https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-response-formats
+    struct Error
+    {
+        /// @brief Identified by the error mnemonic, the numeric code reported by the module is kept in `number`.
+        enum Code : int8_t
+        {
+            None = 0,             /// The last command succeeded.
+            Timeout = -1,         /// No response line was received within the timeout.
+            Unrecognized = -2,    /// The mnemonic is not known, check `number` and `ExpressLink::error`.
+            ParseError = 1,       /// The command could not be parsed.
+            CommandTooLong,       /// The command exceeds the maximum command length of the module.
+            OutOfMemory,          /// The module ran out of memory while processing the command.
+            InvalidEscape,        /// The command contains an invalid escape sequence.
+            UnknownCommand,       /// The command is not supported by the module.
+            InvalidParameter,     /// A parameter of the command is invalid.
+            InvalidKeyName,       /// The configuration key does not exist.
+            InvalidTopic,         /// The topic index does not refer to a configured topic.
+            NotAllowed,           /// The command is not allowed in the current state, e.g., a read-only configuration key.
+            NotConnected,         /// The module is not connected to AWS IoT Core.
+            UnableToConnect,      /// The connection attempt failed.
+            InvalidOTAUpdate,     /// No OTA update is available, or the requested operation does not match it.
+        };
+
+        /// @brief Retry classes of error codes, used as bit mask in `RetryPolicy::retryOn`.
+        enum Class : uint8_t
+        {
+            Transient = 1,    /// The module is busy, out of memory or not connected, a later attempt may succeed.
+            TimedOut = 2,     /// No response line was received within the timeout.
+            Permanent = 4,    /// The command or its parameters are invalid, repeating it cannot succeed.
+            Unclassified = 8, /// Unrecognized mnemonics.
+        };
+
+        Code code;
+        uint16_t number;    /// numeric code of the `ERR{n}` response, 0 if none was received
+        const char *detail; /// optional text after the mnemonic, valid until the next command
+
+        Class category() const;
+    };
+
+    /// @brief Configures how often and how fast `publish()`, `connect()`, `subscribe()` and the shadow commands are repeated after an error.
+    /// The delay before each retry grows exponentially, starting at `delay` and limited to `maxDelay`, and is randomized by `jitter`.
+    struct RetryPolicy
+    {
+        uint8_t attempts = 1;     /// total number of attempts including the first one, 1 disables retries
+        uint32_t delay = 100;     /// delay before the first retry in milliseconds, doubled for each further retry
+        uint32_t maxDelay = 5000; /// upper limit of the delay in milliseconds
+        uint8_t jitter = 25;      /// random variation of each delay, in percent
+        /// bit mask of `Error::Class` values to retry. `Error::TimedOut` is not included by default, as the module may still
+        /// execute the timed-out command, e.g., publish the message. If added, `delay` should exceed the expected late response
+        /// time, so a late response is recognized instead of sending the command twice.
+        uint8_t retryOn = Error::Transient;
+    };
+
+#if EXPRESSLINK_STATISTICS
+    /// @brief Counters of the UART link, see `ExpressLink::statistics()`. Copy it to take a snapshot.
+    struct Statistics
+    {
+        enum CommandType : uint8_t
+        {
+            SendCommand = 0,    /// `SEND`
+            GetCommand,         /// `GET`
+            ConnectCommand,     /// `CONNECT`, `CONNECT?` and `DISCONNECT`
+            ConfCommand,        /// `CONF` and `CONF?`
+            EventCommand,       /// `EVENT?`
+            SubscribeCommand,   /// `SUBSCRIBE` and `UNSUBSCRIBE`
+            ShadowCommand,      /// `SHADOW`
+            OTACommand,         /// `OTA`
+            OtherCommand,       /// all other commands
+            COMMAND_TYPES,
+        };
+
+        /// @brief Upper bounds in milliseconds of the first `BUCKETS - 1` latency buckets, the last bucket counts all slower commands.
+        static const uint16_t BUCKET_LIMITS[];
+        static const uint8_t BUCKETS = 8;
+
+        struct Latency
+        {
+            uint32_t count;              /// completed commands, including errors and timeouts
+            uint32_t histogram[BUCKETS]; /// commands per latency bucket, see `BUCKET_LIMITS`
+            uint32_t max;                /// slowest command in milliseconds
+        };
+
+        Latency latency[COMMAND_TYPES];
+        uint32_t bytesSent;     /// bytes written to the UART
+        uint32_t bytesReceived; /// bytes read from the UART
+        uint32_t timeouts;      /// commands without a response within the timeout
+        uint32_t errors[Error::InvalidOTAUpdate - Error::Unrecognized + 1]; /// `ERR` responses indexed by `Error::Code - Error::Unrecognized`
+        uint32_t events[LAST_EVENT_CODE]; /// events indexed by `EventCode`, index 0 counts `UNKNOWN` events
+        uint32_t maxResponse;   /// longest response line in bytes
+
+        /// @return number of `ERR` responses with the given code
+        uint32_t errorCount(Error::Code code) const { return errors[code - Error::Unrecognized]; }
+    };
+#endif
+
+    enum LogLevel : uint8_t
+    {
+        LogNone = EXPRESSLINK_LOG_NONE,       /// Nothing is logged.
+        LogError = EXPRESSLINK_LOG_ERROR,     /// Commands that timed out.
+        LogWarning = EXPRESSLINK_LOG_WARNING, /// `ERR` responses and retries.
+        LogInfo = EXPRESSLINK_LOG_INFO,       /// Connection state changes.
+        LogDebug = EXPRESSLINK_LOG_DEBUG,     /// Every command and response line.
+    };
+
+    /// @brief Receives log output. A log line may be passed in several fragments, and always ends with `\n`.
+    /// Commands are logged as `> AT+...`, responses as `< ...`, other messages start with `! ` or `* `.
+    typedef void (*LogSink)(LogLevel level, const char *text, size_t length, void *context);
+
+#if EXPRESSLINK_TRACE
+    /// @brief A log line recorded in the trace ring buffer, see `ExpressLink::trace()`.
+    struct TraceEntry
+    {
+        unsigned long time;                  /// `now()` when the line was started
+        char text[EXPRESSLINK_TRACE_LENGTH]; /// null-terminated log line without `\n`, possibly truncated
+    };
+#endif
+
+    /// @brief Receives a response line streamed by `cmdStream()` or `streamLine()`, unescaped, fragment by fragment as the bytes arrive from the UART.
+    /// @param data next fragment of the line, not null-terminated
+    /// @param length number of bytes in `data`
+    /// @param end true for the final call of each line, with no data
+    /// @return true to continue, false to discard the rest of the line
+    typedef bool (*ResponseSink)(const char *data, size_t length, bool end, void *context);
+
+    /// @brief Receives a multi-line response line by line, see `cmdLines()`.
+    /// @param line null-terminated, unescaped and trimmed line, valid until the sink returns
+    /// @param length number of bytes in `line`
+    /// @return true to continue, false to skip the remaining lines
+    typedef bool (*LineSink)(const char *line, size_t length, void *context);
+
+    struct Command;
+
+    /// @brief Invoked repeatedly while waiting for the UART, e.g., to sample sensors or feed a watchdog.
+    /// It must not send commands through the same `ExpressLink` instance.
+    /// @param command command waiting for its response, or `nullptr` while waiting for additional lines,
+    /// a retry delay or a paced publish
+    /// @param elapsed time spent waiting so far, in milliseconds
+    typedef void (*IdleHook)(ExpressLink &expresslink, const Command *command, uint32_t elapsed, void *context);
+
+    /// @brief Returns the current time in milliseconds, see `ExpressLink::setClock()`.
+    typedef unsigned long (*Clock)(void *context);
+
+    /// @brief Time spent in the `IdleHook`, see `ExpressLink::idleStatistics()`.
+    struct IdleStatistics
+    {
+        uint32_t calls; /// number of hook invocations
+        uint64_t time;  /// total time spent in the hook in microseconds, i.e., CPU time reclaimed while waiting
+    };
+
+    /// @brief Handle for a command queued with `cmdAsync()` or `publishAsync()`.
+    /// The handle, and the command or message buffer it refers to, are owned by the caller and must stay valid while the command is pending.
+    struct Command
+    {
+        enum Status : uint8_t
+        {
+            Idle = 0,      /// Not queued yet.
+            Queued = 1,    /// Waiting for previous commands to complete.
+            Sent = 2,      /// Written to the UART, waiting for the response line.
+            Succeeded = 3, /// Response was `OK`. Check `ExpressLink::response` from the callback.
+            Failed = 4,    /// Response was `ERR`. Check `ExpressLink::error` from the callback.
+            TimedOut = 5,  /// No response line was received within the timeout.
+        };
+
+        /// @brief Invoked from `ExpressLink::poll()` once the command has completed.
+        typedef void (*Callback)(ExpressLink &expresslink, Command &command);
+
+        /// @brief Produces the next chunk of a streamed payload.
+        /// @return number of bytes written to `buffer` (at most `size`), 0 at the end of the payload
+        typedef size_t (*Producer)(uint8_t *buffer, size_t size, void *context);
+
+        Status status = Idle;
+        /// @brief number of additional response lines, see `ExpressLink::additionalLines`
+        uint32_t additionalLines = 0;
+        /// @brief maximum time to wait for the response in milliseconds, 0 to use `ExpressLink::setTimeout()`
+        uint32_t timeout = 0;
+        Callback callback = nullptr;
+        void *context = nullptr;
+
+        /// @return true while the command is queued or waiting for its response
+        bool pending() const { return status == Queued || status == Sent; }
+        /// @return command name and parameters without the `AT+` prefix and the payload, e.g., `SEND1 ` or `CONNECT`,
+        /// empty for `cmd()` and `cmdAsync()`, which pass the whole command as payload
+        const char *name() const { return header; }
+
+    private:
+        friend class ExpressLink;
+        char header[32];
+        const char *payload;
+        size_t length;
+        Producer producer;
+        void *source;
+        ResponseSink sink;
+        void *sinkContext;
+        bool raw;
+        unsigned long started;
+        Command *next;
     };
 
     ExpressLink(void);
-    bool begin(Stream &s, int event = -1, int wake = -1, int reset = -1, bool debug = false);
+    bool begin(Stream &s, int event = -1, int wake = -1, int reset = -1, bool debug = false, bool eventInterrupt = false);
 
+#if !EXPRESSLINK_STATIC
     bool cmd(String command);
+#endif
+    bool cmd(const char *command);
+    bool cmd(const char *command, size_t length, uint32_t timeout = 0);
+    bool cmdStream(const char *command, ResponseSink sink, void *context = nullptr, uint32_t timeout = 0);
+    bool cmdLines(const char *command, LineSink sink, void *context = nullptr, uint32_t timeout = 0);
+    void setTimeout(uint32_t timeout);
+    void setClock(Clock clock, void *context = nullptr);
+    unsigned long now() const;
+    void setRetryPolicy(const RetryPolicy &policy);
+    /// @return the policy set with `setRetryPolicy()`
+    const RetryPolicy &retryPolicy() const { return retry; }
+    Error lastError() const;
+
+    void onIdle(IdleHook hook, void *context = nullptr);
+    /// @return time spent in the idle hook since `begin()` or the last `resetIdleStatistics()`
+    const IdleStatistics &idleStatistics() const { return idleStats; }
+    void resetIdleStatistics();
+
+    void setLogSink(LogSink sink, void *context = nullptr, LogLevel level = LogDebug);
+    static void printLog(LogLevel level, const char *text, size_t length, void *context);
+    static int hexValue(char c);
+    static bool shadowHeader(char *header, size_t size, uint8_t index, const char *command);
+#if EXPRESSLINK_TRACE
+    uint8_t traceCount() const;
+    const TraceEntry &trace(uint8_t index) const;
+    void dumpTrace(Print &out) const;
+#endif
+#if EXPRESSLINK_STATISTICS
+    /// @return counters since `begin()` or the last `resetStatistics()`
+    const Statistics &statistics() const { return stats; }
+    void resetStatistics();
+#endif
+
+    bool cmdAsync(Command &handle, const char *command, Command::Callback callback = nullptr, void *context = nullptr);
+    bool publishAsync(Command &handle, uint8_t topic_index, const char *message, size_t length, Command::Callback callback = nullptr, void *context = nullptr);
+    bool poll();
 
     bool selfTest();
 
     bool connect(bool async = false);
     bool isConnected();
     bool isOnboarded();
+    ConnectionStatus connectionStatus();
+    /// @return connection state as of the last `connectionStatus()` call, connection command or event, without any UART communication
+    const ConnectionStatus &lastConnectionStatus() const { return connection; }
     bool disconnect();
 
     bool reset();
@@ -132,12 +631,28 @@ public:
     bool sleep(uint32_t duration, uint8_t sleep_mode = 0);
 
     Event getEvent(bool checkPin = true);
+    bool eventPending();
+    void onEvent(EventCode code, EventHandler handler, void *context = nullptr);
+    uint16_t processEvents(uint16_t maxEvents = 0, uint32_t budget = 0);
 
+#if !EXPRESSLINK_STATIC
     bool subscribe(uint8_t topic_index, String topic_name);
+#endif
+    bool subscribe(uint8_t topic_index, const char *topic_name);
     bool unsubscribe(uint8_t topic_index);
     bool get(uint8_t topic_index = -1); // -1 = GET, 0...X = GETX
+    bool receive(uint8_t topic_index, Message &message, char *buffer, size_t size);
+    uint16_t drain(uint8_t topic_index, char *buffer, size_t size, MessageHandler handler, void *context = nullptr, uint16_t maxMessages = 0);
+#if !EXPRESSLINK_STATIC
     bool send(uint8_t topic_index, String message);
     bool publish(uint8_t topic_index, String message);
+#endif
+    bool send(uint8_t topic_index, const char *message);
+    bool publish(uint8_t topic_index, const char *message);
+    bool publish(uint8_t topic_index, const char *message, size_t length);
+    bool publish(uint8_t topic_index, const uint8_t *message, size_t length);
+    bool publish(uint8_t topic_index, Stream &message);
+    bool publish(uint8_t topic_index, Command::Producer producer, void *context = nullptr);
 
     OTAState otaGetState();
     bool otaAccept();
@@ -146,11 +661,16 @@ public:
     bool otaApply();
     bool otaClose();
     bool otaFlush();
+    OTADownload otaDownload(OTASink sink, void *context = nullptr, uint32_t chunkSize = 0, uint32_t offset = 0, bool pipelined = false);
 
     bool shadowInit(uint8_t index = -1);
     bool shadowDoc(uint8_t index = -1);
     bool shadowGetDoc(uint8_t index = -1);
+#if !EXPRESSLINK_STATIC
     bool shadowUpdate(String new_state, uint8_t index = -1);
+#endif
+    bool shadowUpdate(const char *new_state, uint8_t index = -1);
+    bool shadowUpdate(const char *new_state, size_t length, uint8_t index);
     bool shadowGetUpdate(uint8_t index = -1);
     bool shadowSubscribe(uint8_t index = -1);
     bool shadowUnsubscribe(uint8_t index = -1);
@@ -162,9 +682,14 @@ public:
 
     ExpressLinkConfig config;
 
-    String readLine(uint32_t count = 1);
-    String response;
+    ExpressLinkText readLine(uint32_t count = 1, uint32_t timeout = 0);
+    bool streamLine(ResponseSink sink, void *context = nullptr, uint32_t count = 1, uint32_t timeout = 0);
+    ExpressLinkText response;
+#if EXPRESSLINK_STATIC
+    ExpressLinkString<EXPRESSLINK_MAX_ERROR> error;
+#else
     String error;
+#endif
     uint32_t additionalLines;
 
     /// @brief The default UART configuration shall be 115200, 8, N, 1
@@ -178,12 +703,117 @@ public:
     /// See https://docs.aws.amazon.com/iot-expresslink/latest/programmersguide/elpg-commands.html#elpg-response-timeout
     static const uint32_t TIMEOUT = 120000; // milliseconds
 
+    /// @brief Number of times `otaDownload()` seeks back and reads a chunk again after an error, before giving up.
+    static const uint8_t OTA_RETRIES = 3;
+
 protected:
-    void escape(String &value);
-    void unescape(String &value);
+    bool escape(ExpressLinkText &value);
+    void unescape(ExpressLinkText &value);
 
 private:
-    bool debug;
+    bool execute(const char *header, const char *payload = "", size_t length = 0, uint32_t timeout = 0);
+    bool executeWithRetry(const char *header, const char *payload = "", size_t length = 0, uint32_t timeout = 0);
+    bool executeProduced(const char *header, Command::Producer producer, void *context);
+    void parseError(int length);
+    bool rejectCommand(const char *reason);
+    void recordCommand(const Command &command, int length);
+    void recordEvent(EventCode code);
+    void log(LogLevel level, const char *text, size_t length);
+    void log(LogLevel level, const char *text);
+    bool shadow(uint8_t index, const char *command, const char *payload = "", size_t length = 0);
+    bool prepare(Command &command, const char *header, const char *payload, size_t length);
+    bool wait(Command &command);
+    void idle(const Command *command, unsigned long started);
+    bool enqueue(Command &command);
+    void transmit(Command &command);
+    void transmitEscaped(const char *data, size_t length);
+    void transmitRaw(const char *data, size_t length);
+    void complete(Command &command, int length);
+    void fill();
+    size_t buffered(const uint8_t *&segment, bool &eol);
+    void consume(size_t count);
+    size_t receivePrefix(const char *data, size_t length);
+    void stream(const char *data, size_t length);
+    bool emit(const char *data, size_t length);
+    int receiveLine();
+    int readResponse(uint32_t timeout = 0);
+
+    /// @brief preallocated buffer for the current response line
+    char line[EXPRESSLINK_MAX_LINE];
+    /// @brief number of bytes of the partially received response line in `line`
+    size_t received = 0;
+    /// @brief true if bytes of the partially received (`dropping`) or last complete (`truncated`) line were discarded
+    bool dropping = false;
+    bool truncated = false;
+    /// @brief ring buffer of bytes read from the UART but not consumed yet
+    uint8_t rx[EXPRESSLINK_RX_BUFFER];
+    size_t rxHead = 0;
+    size_t rxCount = 0;
+    /// @brief receives the current response line instead of `line`, see `cmdStream()` and `streamLine()`
+    ResponseSink streamSink = nullptr;
+    void *streamContext = nullptr;
+    enum StreamState : uint8_t
+    {
+        StreamOff,     /// the line is received into `line`
+        StreamPrefix,  /// the status prefix, e.g. `OK1 `, is received into `line` until it decides whether the rest is streamed
+        StreamOn,      /// the rest of the line is passed to `streamSink`
+        StreamDiscard, /// the sink returned false, the rest of the line is dropped
+    };
+    StreamState streamState = StreamOff;
+    /// @brief true if the last streamed fragment ended with the `\\` of an escape sequence
+    bool streamEscape = false;
+    /// @brief default response timeout in milliseconds, see `setTimeout()`
+    uint32_t timeout = TIMEOUT;
+    /// @brief points into `line` after the `OK` prefix of the last successful command
+    const char *result = line;
+    /// @brief parsed from the last response, the detail is an offset into `error`
+    Error::Code errorCode = Error::None;
+    uint16_t errorNumber = 0;
+    uint16_t errorDetail = 0;
+    RetryPolicy retry;
+#if EXPRESSLINK_STATISTICS
+    Statistics stats;
+#endif
+
+    /// @brief first queued command, which is in flight once its status is `Command::Sent`
+    Command *queue = nullptr;
+    Command *queueTail = nullptr;
+    void trackConnection(bool connected);
+
+    ConnectionStatus connection = {false, false, 0};
+
+    /// @brief registered event handlers indexed by event code, index 0 holds the handler for `UNKNOWN` and unhandled events
+    EventHandler eventHandlers[LAST_EVENT_CODE] = {};
+    void *eventContexts[LAST_EVENT_CODE] = {};
+
+    /// @brief additional lines of the last response not read yet, discarded before the next command is sent
+    uint32_t pendingLines = 0;
+    /// @brief true after a command timed out, its response is discarded if it has arrived before the next command is sent
+    bool lateResponse = false;
+
+    static void onEventInterrupt();
+    /// @brief set from the EVENT pin interrupt, cleared before each `AT+EVENT?`
+    static volatile bool eventSignaled;
+
+    Clock clock = nullptr;
+    void *clockContext = nullptr;
+
+    IdleHook idleHook = nullptr;
+    void *idleContext = nullptr;
+    IdleStatistics idleStats = {0, 0};
+
+    LogSink logSink = nullptr;
+    void *logContext = nullptr;
+    LogLevel logLevel = LogDebug;
+    /// @brief true while `transmitRaw()` passes the bytes to the log, see `EXPRESSLINK_LOG_PAYLOAD`
+    bool logTransmit = false;
+#if EXPRESSLINK_TRACE
+    TraceEntry traceEntries[EXPRESSLINK_TRACE];
+    uint8_t traceHead = 0;   /// index of the oldest entry
+    uint8_t traceSize = 0;   /// number of recorded entries
+    size_t traceLength = 0;  /// length of the text in the newest entry
+    bool traceOpen = false;  /// true while the newest entry has not received its `\n`
+#endif
     Stream *uart;
     int resetPin = -1;
     int eventPin = -1;
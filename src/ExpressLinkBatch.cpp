@@ -0,0 +1,164 @@
+#include "ExpressLinkBatch.h"
+
+/// @brief Creates a batch for one topic.
+/// @param el ExpressLink interface to publish with
+/// @param topic_index the topic index to publish to
+/// @param buffer storage for the pending samples, must stay valid for the lifetime of the batch
+/// @param size capacity of `buffer` in bytes, which is also the default size limit of a message
+/// @param format how samples are joined into a message
+ExpressLinkBatch::ExpressLinkBatch(ExpressLink &el, uint8_t topic_index, char *buffer, size_t size, Format format)
+    : expresslink(el), topic(topic_index), buffer(buffer), size(size), format(format), maxBytes(size)
+{
+    // constructor
+}
+
+/// @brief Sets the limits that trigger publishing the batch.
+/// @param maxBytes maximum message size in bytes, 0 to use the buffer size
+/// @param maxCount maximum number of samples per message, 0 for no limit
+/// @param maxDelay maximum time in milliseconds a sample waits in the batch, 0 for no limit. Requires calling `poll()`.
+void ExpressLinkBatch::setPolicy(size_t maxBytes, uint16_t maxCount, uint32_t maxDelay)
+{
+    this->maxBytes = (maxBytes == 0 || maxBytes > size) ? size : maxBytes;
+    this->maxCount = maxCount;
+    this->maxDelay = maxDelay;
+}
+
+/// @brief Paces the publishes of the batch, and limits its message size to `ExpressLinkPacer::batchBytes()`.
+/// @param pacer pacer to use, `nullptr` to publish immediately with the size limit of `setPolicy()`
+void ExpressLinkBatch::setPacer(ExpressLinkPacer *pacer)
+{
+    this->pacer = pacer;
+}
+
+/// @return size limit of a message, the smaller of the policy and the pacer limit
+size_t ExpressLinkBatch::limit() const
+{
+    if (pacer != nullptr && pacer->batchBytes() < maxBytes)
+    {
+        return pacer->batchBytes();
+    }
+    return maxBytes;
+}
+
+/// @brief Adds a sample to the batch, publishing the batch first if the sample does not fit.
+/// A sample that exceeds the size limit on its own is published as a separate message, in `JSONArray` format as an
+/// array of one sample. Such a sample is rejected and counted as dropped if it does not fit into the buffer with the brackets.
+/// @return false if a publish failed or the sample was rejected
+bool ExpressLinkBatch::add(const char *sample)
+{
+    return add(sample, strlen(sample));
+}
+
+/// @brief Adds a sample to the batch, see `add(const char *)`.
+/// @param sample raw sample, typically a JSON object
+/// @param n number of bytes in `sample`
+/// @return false if a publish failed or the sample was rejected
+bool ExpressLinkBatch::add(const char *sample, size_t n)
+{
+    stats.samples++;
+    const size_t framing = (format == JSONArray) ? 2 : 0; // opening and closing bracket
+    const size_t maxSize = limit();
+    if (n + framing > maxSize)
+    {
+        bool success = flush();
+        if (format == JSONArray)
+        {
+            // every message is an array, even a single sample
+            if (n + framing > size)
+            {
+                stats.dropped++;
+                return false;
+            }
+            buffer[0] = '[';
+            memcpy(buffer + 1, sample, n);
+            length = n + 1;
+            count = 1;
+            return flush() && success;
+        }
+        stats.messages++;
+        if (!(pacer ? pacer->publish(topic, sample, n) : expresslink.publish(topic, sample, n)))
+        {
+            stats.failures++;
+            stats.dropped++;
+            return false;
+        }
+        return success;
+    }
+
+    bool success = true;
+    if (count > 0 && length + 1 + n + framing > maxSize)
+    {
+        success = flush();
+    }
+    if (count == 0)
+    {
+        length = 0;
+        if (format == JSONArray)
+        {
+            buffer[length++] = '[';
+        }
+        started = expresslink.now();
+    }
+    else
+    {
+        buffer[length++] = (format == JSONArray) ? ',' : '\n';
+    }
+    memcpy(buffer + length, sample, n);
+    length += n;
+    count++;
+
+    if (maxCount > 0 && count >= maxCount)
+    {
+        success = flush() && success;
+    }
+    return success;
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief Adds a sample to the batch, see `add(const char *)`.
+/// @return false if a publish failed
+bool ExpressLinkBatch::add(const String &sample)
+{
+    return add(sample.c_str(), sample.length());
+}
+#endif
+
+/// @brief Publishes all pending samples as a single message.
+/// Samples of a failed publish are dropped and counted in `Statistics::dropped`.
+/// @return true on success or if the batch was empty, false on error
+bool ExpressLinkBatch::flush()
+{
+    if (count == 0)
+    {
+        return true;
+    }
+    if (format == JSONArray)
+    {
+        buffer[length++] = ']';
+    }
+    bool success = pacer ? pacer->publish(topic, buffer, length) : expresslink.publish(topic, buffer, length);
+    stats.messages++;
+    if (success)
+    {
+        stats.coalesced += count - 1;
+    }
+    else
+    {
+        stats.failures++;
+        stats.dropped += count;
+    }
+    length = 0;
+    count = 0;
+    return success;
+}
+
+/// @brief Publishes the batch once its oldest sample has waited longer than the delay limit. Call it from `loop()`.
+/// @return false if a publish failed
+bool ExpressLinkBatch::poll()
+{
+    if (count > 0 && maxDelay > 0 && expresslink.now() - started >= maxDelay)
+    {
+        return flush();
+    }
+    return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ExpressLink.h"
+#include "ExpressLinkPacer.h"
+
+/// @brief Coalesces samples published on one topic into fewer, larger messages.
+///
+/// Every `AT+SEND` pays a full command round-trip over the UART. Samples added to a batch are collected in a
+/// caller-supplied buffer and published together as a single JSON array (`[s1,s2,...]`) or as newline-delimited
+/// records, when the batch reaches its size or count limit, or when its oldest sample exceeds the delay limit.
+class ExpressLinkBatch
+{
+public:
+    enum Format : uint8_t
+    {
+        JSONArray = 0, /// `[sample1,sample2,...]`, each sample must be a JSON value
+        Lines = 1,     /// `sample1\nsample2...`, newlines are escaped on the wire
+    };
+
+    struct Statistics
+    {
+        uint32_t samples;   /// samples added
+        uint32_t messages;  /// messages published
+        uint32_t coalesced; /// samples that were published as part of another sample's message
+        uint32_t failures;  /// failed publishes
+        uint32_t dropped;   /// samples lost due to failed publishes
+    };
+
+    ExpressLinkBatch(ExpressLink &el, uint8_t topic_index, char *buffer, size_t size, Format format = JSONArray);
+
+    void setPolicy(size_t maxBytes, uint16_t maxCount = 0, uint32_t maxDelay = 1000);
+    void setPacer(ExpressLinkPacer *pacer);
+
+    bool add(const char *sample);
+    bool add(const char *sample, size_t length);
+#if !EXPRESSLINK_STATIC
+    bool add(const String &sample);
+#endif
+    bool flush();
+    bool poll();
+
+    /// @return number of samples waiting in the batch
+    uint16_t pending() const { return count; }
+    const Statistics &statistics() const { return stats; }
+
+private:
+    size_t limit() const;
+
+    ExpressLink &expresslink;
+    ExpressLinkPacer *pacer = nullptr;
+    uint8_t topic;
+    char *buffer;
+    size_t size;
+    Format format;
+
+    size_t maxBytes;
+    uint16_t maxCount = 0;
+    uint32_t maxDelay = 1000;
+
+    size_t length = 0;
+    uint16_t count = 0;
+    unsigned long started = 0;
+    Statistics stats = {};
+};
@@ -0,0 +1,256 @@
+#include "ExpressLinkCBOR.h"
+
+/// @brief CBOR major types, see https://www.rfc-editor.org/rfc/rfc8949#section-3.1
+enum Major : uint8_t
+{
+    Unsigned = 0,
+    Negative = 1,
+    ByteString = 2,
+    TextString = 3,
+    Array = 4,
+    Map = 5,
+    Simple = 7,
+};
+
+/// @brief Converts `value` to IEEE 754 half-precision, if that is possible without loss.
+/// @return false if `value` needs more precision or range than a half-precision number has
+static bool toHalf(float value, uint16_t &half)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exponent = (bits >> 23) & 0xFF;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    if (exponent == 0xFF)
+    {
+        half = sign | 0x7C00 | (mantissa ? 0x200 : 0); // infinity, or the canonical NaN
+        return true;
+    }
+    if (exponent == 0 && mantissa == 0)
+    {
+        half = sign;
+        return true;
+    }
+    int e = exponent - 127 + 15;
+    if (e >= 31)
+    {
+        return false;
+    }
+    if (e >= 1)
+    {
+        half = sign | e << 10 | mantissa >> 13;
+        return (mantissa & 0x1FFF) == 0;
+    }
+    if (e < -10)
+    {
+        return false;
+    }
+    // subnormal half-precision number
+    uint32_t full = mantissa | 0x800000;
+    uint8_t shift = 14 - e;
+    half = sign | full >> shift;
+    return (full & ((1UL << shift) - 1)) == 0;
+}
+
+/// @brief Creates a writer for messages of up to `size` bytes.
+/// @param buffer storage for the encoded message, must stay valid for the lifetime of the writer
+/// @param size capacity of `buffer` in bytes
+ExpressLinkCBOR::ExpressLinkCBOR(uint8_t *buffer, size_t size)
+    : buffer(buffer), size(size)
+{
+    // constructor
+}
+
+/// @brief Discards the message, to start the next one.
+void ExpressLinkCBOR::reset()
+{
+    used = 0;
+    overflow = false;
+}
+
+/// @brief Starts a map, followed by `count` pairs of a key and a value.
+/// @param count number of pairs, or `INDEFINITE` to close the map with `end()`
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::beginMap(uint16_t count)
+{
+    if (count == INDEFINITE)
+    {
+        const uint8_t start = Map << 5 | 31;
+        return put(&start, 1);
+    }
+    return head(Map, count);
+}
+
+/// @brief Starts an array, followed by `count` values.
+/// @param count number of values, or `INDEFINITE` to close the array with `end()`
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::beginArray(uint16_t count)
+{
+    if (count == INDEFINITE)
+    {
+        const uint8_t start = Array << 5 | 31;
+        return put(&start, 1);
+    }
+    return head(Array, count);
+}
+
+/// @brief Closes the innermost map or array started with `INDEFINITE`.
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::end()
+{
+    const uint8_t stop = Simple << 5 | 31;
+    return put(&stop, 1);
+}
+
+/// @brief Adds the key of the next map value, as a text string.
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addKey(const char *key)
+{
+    return addString(key);
+}
+
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addInt(int64_t value)
+{
+    if (value < 0)
+    {
+        return head(Negative, (uint64_t)(-(value + 1)));
+    }
+    return head(Unsigned, value);
+}
+
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addUnsigned(uint64_t value)
+{
+    return head(Unsigned, value);
+}
+
+/// @brief Adds a floating-point number, in half, single or double precision, whichever is the shortest without loss.
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addFloat(double value)
+{
+    float single = (float)value;
+    if (single == value || value != value) // NaN is encoded as a half-precision NaN
+    {
+        uint16_t half;
+        if (toHalf(single, half))
+        {
+            const uint8_t encoded[] = {Simple << 5 | 25, (uint8_t)(half >> 8), (uint8_t)half};
+            return put(encoded, sizeof(encoded));
+        }
+        uint32_t bits;
+        memcpy(&bits, &single, sizeof(bits));
+        const uint8_t encoded[] = {Simple << 5 | 26, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits};
+        return put(encoded, sizeof(encoded));
+    }
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint8_t encoded[9] = {Simple << 5 | 27};
+    for (uint8_t i = 0; i < 8; i++)
+    {
+        encoded[8 - i] = (uint8_t)(bits >> (8 * i));
+    }
+    return put(encoded, sizeof(encoded));
+}
+
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addBool(bool value)
+{
+    const uint8_t encoded = Simple << 5 | (value ? 21 : 20);
+    return put(&encoded, 1);
+}
+
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addNull()
+{
+    const uint8_t encoded = Simple << 5 | 22;
+    return put(&encoded, 1);
+}
+
+/// @brief Adds a null-terminated UTF-8 text string.
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addString(const char *value)
+{
+    return addString(value, strlen(value));
+}
+
+/// @brief Adds a UTF-8 text string of `length` bytes.
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addString(const char *value, size_t length)
+{
+    return head(TextString, length) && put((const uint8_t *)value, length);
+}
+
+/// @brief Adds a byte string, e.g., raw samples.
+/// @return false if the buffer is full
+bool ExpressLinkCBOR::addBytes(const uint8_t *value, size_t length)
+{
+    return head(ByteString, length) && put(value, length);
+}
+
+/// @return number of bytes the message takes on the UART, i.e., its base64-encoded length
+size_t ExpressLinkCBOR::wireLength() const
+{
+    return (used + 2) / 3 * 4;
+}
+
+/// @brief Publishes the message base64-encoded, see `ExpressLink::publish(uint8_t, Command::Producer, void *)`.
+/// The message is encoded chunk by chunk while it is written to the UART, and sent in a single attempt; call it again
+/// to retry, the buffer is left unchanged.
+/// @param topic_index the topic index to publish to
+/// @return true on success, false on error or if the message overflowed the buffer
+bool ExpressLinkCBOR::publish(ExpressLink &expresslink, uint8_t topic_index)
+{
+    if (overflow)
+    {
+        return false;
+    }
+    encoded = 0;
+    return expresslink.publish(topic_index, produce, this);
+}
+
+/// @brief Encodes the next groups of up to 3 message bytes as 4 base64 digits each, see `ExpressLink::Command::Producer`.
+size_t ExpressLinkCBOR::produce(uint8_t *buffer, size_t size, void *context)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    ExpressLinkCBOR &cbor = *(ExpressLinkCBOR *)context;
+    size_t n = 0;
+    while (n + 4 <= size && cbor.encoded < cbor.used)
+    {
+        const uint8_t *in = cbor.buffer + cbor.encoded;
+        size_t left = cbor.used - cbor.encoded;
+        uint32_t group = (uint32_t)in[0] << 16 | (left > 1 ? in[1] << 8 : 0) | (left > 2 ? in[2] : 0);
+        buffer[n++] = digits[(group >> 18) & 0x3F];
+        buffer[n++] = digits[(group >> 12) & 0x3F];
+        buffer[n++] = left > 1 ? digits[(group >> 6) & 0x3F] : '=';
+        buffer[n++] = left > 2 ? digits[group & 0x3F] : '=';
+        cbor.encoded += left < 3 ? left : 3;
+    }
+    return n;
+}
+
+/// @brief Writes the initial byte of a data item with its argument, in the shortest form.
+bool ExpressLinkCBOR::head(uint8_t major, uint64_t value)
+{
+    uint8_t encoded[9];
+    uint8_t bytes = (value < 24) ? 0 : (value <= 0xFF) ? 1 : (value <= 0xFFFF) ? 2 : (value <= 0xFFFFFFFFUL) ? 4 : 8;
+    encoded[0] = major << 5 | ((bytes == 0) ? (uint8_t)value : (bytes == 1) ? 24 : (bytes == 2) ? 25 : (bytes == 4) ? 26 : 27);
+    for (uint8_t i = 0; i < bytes; i++)
+    {
+        encoded[bytes - i] = (uint8_t)(value >> (8 * i));
+    }
+    return put(encoded, bytes + 1);
+}
+
+/// @brief Appends `length` bytes to the message, or marks it overflowed if they do not fit.
+bool ExpressLinkCBOR::put(const uint8_t *data, size_t length)
+{
+    if (overflow || length > size - used)
+    {
+        overflow = true;
+        return false;
+    }
+    memcpy(buffer + used, data, length);
+    used += length;
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "ExpressLink.h"
+
+/// @brief Writes a compact binary (CBOR, RFC 8949) message in-place into a caller-supplied buffer, for `publish()`.
+///
+/// Values are encoded in their shortest form: integers in 0 to 8 bytes after the type, and floating-point numbers as
+/// half, single or double precision, whichever holds them without loss. The ExpressLink command line cannot carry
+/// arbitrary bytes, as the module trims whitespace at both ends of a line and payloads end at a null byte, so `publish()`
+/// sends the message base64-encoded (RFC 4648, with padding), encoding it from the buffer while it is written to the
+/// UART. Subscribers decode the base64 text to get the CBOR message. A typical sensor record is about 40% smaller than
+/// its JSON form, and still about 20% smaller on the wire, see `wireLength()`.
+///
+/// Maps are written as alternating keys and values, e.g., `beginMap(2); addKey("t"); addFloat(21.5); addKey("ok"); addBool(true);`
+class ExpressLinkCBOR
+{
+public:
+    /// @brief Count for `beginMap()` and `beginArray()` if the number of items is not known in advance, requires `end()`.
+    static const uint16_t INDEFINITE = 0xFFFF;
+
+    ExpressLinkCBOR(uint8_t *buffer, size_t size);
+
+    void reset();
+
+    bool beginMap(uint16_t count = INDEFINITE);
+    bool beginArray(uint16_t count = INDEFINITE);
+    bool end();
+
+    bool addKey(const char *key);
+    bool addInt(int64_t value);
+    bool addUnsigned(uint64_t value);
+    bool addFloat(double value);
+    bool addBool(bool value);
+    bool addNull();
+    bool addString(const char *value);
+    bool addString(const char *value, size_t length);
+    bool addBytes(const uint8_t *value, size_t length);
+
+    /// @return encoded message
+    const uint8_t *data() const { return buffer; }
+    /// @return number of bytes in the encoded message
+    size_t length() const { return used; }
+    /// @return true if a value did not fit into the buffer since the last `reset()`, the message is incomplete
+    bool overflowed() const { return overflow; }
+    size_t wireLength() const;
+
+    bool publish(ExpressLink &expresslink, uint8_t topic_index);
+
+private:
+    bool head(uint8_t major, uint64_t value);
+    bool put(const uint8_t *data, size_t length);
+    static size_t produce(uint8_t *buffer, size_t size, void *context);
+
+    uint8_t *buffer;
+    size_t size;
+    size_t used = 0;
+    bool overflow = false;
+    /// @brief number of message bytes already encoded by `produce()`
+    size_t encoded = 0;
+};
@@ -0,0 +1,559 @@
+#include "ExpressLinkJSON.h"
+
+/// @return true if `path` equals `filter` or lies below it. A `*` segment of `filter` matches any single segment.
+static bool matchPath(const char *filter, const char *path)
+{
+    while (*filter != '\0')
+    {
+        if (*filter == '*' && (filter[1] == '.' || filter[1] == '\0'))
+        {
+            if (*path == '\0')
+            {
+                return false;
+            }
+            filter++;
+            while (*path != '.' && *path != '\0')
+            {
+                path++;
+            }
+        }
+        else
+        {
+            while (*filter != '.' && *filter != '\0' && *filter == *path)
+            {
+                filter++;
+                path++;
+            }
+            if ((*filter != '.' && *filter != '\0') || (*path != '.' && *path != '\0'))
+            {
+                return false;
+            }
+        }
+        // both are at the end of a segment
+        if (*filter == '.')
+        {
+            if (*path != '.')
+            {
+                return false;
+            }
+            filter++;
+            path++;
+        }
+    }
+    return *path == '\0' || *path == '.';
+}
+
+/// @brief Creates a parser that delivers all values, see `select()`.
+/// @param handler called for every delivered value
+/// @param context passed to each `handler` call
+ExpressLinkJSON::ExpressLinkJSON(Handler handler, void *context)
+    : handler(handler), context(context)
+{
+    reset();
+}
+
+/// @brief Adds a path filter. Once filters are set, only values at or below a selected path are delivered.
+///
+/// E.g., `state.desired` selects `state.desired` itself and all its members, `readings.*.t` selects the member `t`
+/// of every element of the `readings` array.
+/// @param path dotted path, must stay valid while the parser is used
+/// @return false if `EXPRESSLINK_JSON_FILTERS` filters are set already
+bool ExpressLinkJSON::select(const char *path)
+{
+    if (filterCount == EXPRESSLINK_JSON_FILTERS)
+    {
+        return false;
+    }
+    filters[filterCount++] = path;
+    return true;
+}
+
+/// @brief Removes all path filters, so all values are delivered.
+void ExpressLinkJSON::selectAll()
+{
+    filterCount = 0;
+}
+
+/// @brief Prepares the parser for a new document. The path filters are kept.
+void ExpressLinkJSON::reset()
+{
+    state = Start;
+    lead = NoLead;
+    key = false;
+    capture = false;
+    depth = 0;
+    overflow = 0;
+    truncatePath(0);
+    textLength = 0;
+    truncated = false;
+    topicName[0] = '\0';
+    topicLength = 0;
+}
+
+/// @brief Parses the next fragment of the document, calling the handler for every completed value.
+/// @param data fragment of the document, not null-terminated
+/// @param length number of bytes in `data`
+/// @return false if the document is malformed, all further input is ignored
+bool ExpressLinkJSON::feed(const char *data, size_t length)
+{
+    for (size_t i = 0; i < length && state != Failed; i++)
+    {
+        step(data[i]);
+    }
+    return state != Failed;
+}
+
+/// @brief Ends the document, delivering a top-level number or literal that was not followed by any delimiter.
+/// @return true if a complete top-level value was parsed
+bool ExpressLinkJSON::finish()
+{
+    if (state == InLiteral && depth == 0)
+    {
+        if (capture)
+        {
+            deliver(literal);
+        }
+        endValue();
+    }
+    return state == Done;
+}
+
+/// @brief Parses a complete null-terminated document, see `feed()`.
+/// @return true if a complete top-level value was parsed
+bool ExpressLinkJSON::parse(const char *json)
+{
+    reset();
+    feed(json, strlen(json));
+    return finish();
+}
+
+/// @brief Streams the shadow document from `AT+SHADOW{index} GET DOC` into the parser while it is received.
+/// Requires a previous `ExpressLink::shadowDoc()` request. The document is not limited by `EXPRESSLINK_MAX_LINE`.
+/// @param index shadow index. Use -1 (default), to select the unnamed shadow.
+/// @return true if a complete document was parsed, false on error, malformed JSON or if no document was received
+bool ExpressLinkJSON::shadowGetDoc(ExpressLink &expresslink, uint8_t index)
+{
+    return shadowGet(expresslink, index, "GET DOC");
+}
+
+/// @brief Streams the delta document from `AT+SHADOW{index} GET DELTA` into the parser while it is received.
+/// @param index shadow index. Use -1 (default), to select the unnamed shadow.
+/// @return true if a complete document was parsed, false on error, malformed JSON or if no delta was received
+bool ExpressLinkJSON::shadowGetDelta(ExpressLink &expresslink, uint8_t index)
+{
+    return shadowGet(expresslink, index, "GET DELTA");
+}
+
+/// @brief Streams the next message pending on the indicated topic into the parser while it is received.
+///
+/// Equivalent to `AT+GET{topic_index}`. For `GET` and `GET0` the topic name is stored, see `topic()`.
+/// @param topic_index use -1 (default) for `GET`, or value for `GETx`
+/// @return true if a complete JSON message was parsed, false if no message was pending, on error or malformed JSON
+bool ExpressLinkJSON::get(ExpressLink &expresslink, uint8_t topic_index)
+{
+    char command[8];
+    if (topic_index == (uint8_t)-1)
+    {
+        snprintf(command, sizeof(command), "GET");
+    }
+    else
+    {
+        snprintf(command, sizeof(command), "GET%u", topic_index);
+    }
+    reset();
+    lead = (topic_index == (uint8_t)-1 || topic_index == 0) ? TopicLead : NoLead;
+    if (!expresslink.cmdStream(command, sink, this))
+    {
+        return false;
+    }
+    if (expresslink.additionalLines > 0)
+    {
+        // OK1 {topic}{EOL}{message}{EOL}
+        lead = NoLead;
+        if (!expresslink.streamLine(sink, this))
+        {
+            return false;
+        }
+    }
+    return state == Done;
+}
+
+/// @brief `ExpressLink::ResponseSink` that feeds a streamed response into the parser, with the parser as context.
+/// E.g., `el.cmdStream("SHADOW GET DOC", ExpressLinkJSON::sink, &parser)`, after `parser.reset()`.
+bool ExpressLinkJSON::sink(const char *data, size_t length, bool end, void *context)
+{
+    ExpressLinkJSON &parser = *(ExpressLinkJSON *)context;
+    if (parser.lead == TopicLead)
+    {
+        size_t copy = sizeof(parser.topicName) - 1 - parser.topicLength;
+        copy = (length < copy) ? length : copy;
+        memcpy(parser.topicName + parser.topicLength, data, copy);
+        parser.topicLength += copy;
+        parser.topicName[parser.topicLength] = '\0';
+        if (end)
+        {
+            parser.lead = NoLead;
+        }
+        return true;
+    }
+    while (parser.lead == StatusLead && length > 0)
+    {
+        parser.lead = (*data == ' ') ? NoLead : StatusLead;
+        data++;
+        length--;
+    }
+    if (!parser.feed(data, length))
+    {
+        return false;
+    }
+    if (end)
+    {
+        parser.finish();
+    }
+    return true;
+}
+
+/// @brief Advances the state machine by one byte.
+void ExpressLinkJSON::step(char c)
+{
+    bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    switch (state)
+    {
+    case Start:
+    case Item:
+    case Element:
+        if (space)
+        {
+            break;
+        }
+        if (state == Element && c == ']')
+        {
+            close(false);
+            break;
+        }
+        beginValue(c);
+        break;
+    case Member:
+        if (space)
+        {
+            break;
+        }
+        if (c == '}')
+        {
+            close(true);
+            break;
+        }
+        if (c != '"')
+        {
+            state = Failed;
+            break;
+        }
+        truncatePath(bases[depth - 1]);
+        if (pathLength > 0)
+        {
+            appendPath('.');
+        }
+        key = true;
+        state = InString;
+        break;
+    case Colon:
+        if (!space)
+        {
+            state = (c == ':') ? Item : Failed;
+        }
+        break;
+    case Next:
+        if (space)
+        {
+            break;
+        }
+        if (c == ',')
+        {
+            if (objects[depth - 1])
+            {
+                state = Member;
+            }
+            else
+            {
+                indices[depth - 1]++;
+                state = Item;
+            }
+        }
+        else if (c == '}' || c == ']')
+        {
+            close(c == '}');
+        }
+        else
+        {
+            state = Failed;
+        }
+        break;
+    case InString:
+        if (c == '"')
+        {
+            if (key)
+            {
+                key = false;
+                state = Colon;
+                break;
+            }
+            if (capture)
+            {
+                deliver(StringValue);
+            }
+            endValue();
+        }
+        else if (c == '\\')
+        {
+            state = InEscape;
+        }
+        else
+        {
+            append(c);
+        }
+        break;
+    case InEscape:
+        state = InString;
+        if (c == 'u')
+        {
+            unicode = 0;
+            unicodeDigits = 0;
+            state = InUnicode;
+            break;
+        }
+        append(c == 'n' ? '\n' : c == 'r' ? '\r' : c == 't' ? '\t' : c == 'b' ? '\b' : c == 'f' ? '\f' : c);
+        break;
+    case InUnicode:
+    {
+        int digit = ExpressLink::hexValue(c);
+        if (digit < 0)
+        {
+            state = Failed;
+            break;
+        }
+        unicode = unicode << 4 | digit;
+        if (++unicodeDigits == 4)
+        {
+            appendUnicode();
+            state = InString;
+        }
+        break;
+    }
+    case InLiteral:
+        if (space || c == ',' || c == '}' || c == ']')
+        {
+            if (capture)
+            {
+                deliver(literal);
+            }
+            endValue();
+            step(c); // the delimiter belongs to the enclosing object or array
+            break;
+        }
+        append(c);
+        break;
+    case Done:
+    case Failed:
+        break; // trailing text is ignored
+    }
+}
+
+/// @brief Starts the value beginning with `c`, after assigning its path.
+void ExpressLinkJSON::beginValue(char c)
+{
+    if (depth > 0 && !objects[depth - 1])
+    {
+        truncatePath(bases[depth - 1]);
+        char index[8];
+        snprintf(index, sizeof(index), pathLength > 0 ? ".%u" : "%u", (unsigned)indices[depth - 1]);
+        for (const char *i = index; *i != '\0'; i++)
+        {
+            appendPath(*i);
+        }
+    }
+    capture = matches();
+    textLength = 0;
+    truncated = false;
+    if (c == '{' || c == '[')
+    {
+        open(c == '{');
+        return;
+    }
+    if (c == '"')
+    {
+        state = InString;
+        return;
+    }
+    if (c == '-' || isDigit(c))
+    {
+        literal = NumberValue;
+    }
+    else if (c == 't' || c == 'f')
+    {
+        literal = BooleanValue;
+    }
+    else if (c == 'n')
+    {
+        literal = NullValue;
+    }
+    else
+    {
+        state = Failed;
+        return;
+    }
+    append(c);
+    state = InLiteral;
+}
+
+/// @brief Ends the current value and returns to its enclosing object or array.
+void ExpressLinkJSON::endValue()
+{
+    if (overflow == depth + 1)
+    {
+        overflow = 0;
+    }
+    truncatePath(depth > 0 ? bases[depth - 1] : 0);
+    state = depth > 0 ? Next : Done;
+}
+
+void ExpressLinkJSON::open(bool object)
+{
+    if (depth == EXPRESSLINK_JSON_DEPTH)
+    {
+        state = Failed;
+        return;
+    }
+    if (capture)
+    {
+        deliver(object ? ObjectStart : ArrayStart);
+    }
+    objects[depth] = object;
+    bases[depth] = pathLength;
+    indices[depth] = 0;
+    depth++;
+    state = object ? Member : Element;
+}
+
+/// @return false if the closing bracket does not match the open object or array
+bool ExpressLinkJSON::close(bool object)
+{
+    if (depth == 0 || objects[depth - 1] != object)
+    {
+        state = Failed;
+        return false;
+    }
+    depth--;
+    truncatePath(bases[depth]);
+    capture = matches();
+    if (capture)
+    {
+        deliver(object ? ObjectEnd : ArrayEnd);
+    }
+    endValue();
+    return true;
+}
+
+/// @brief Appends a character to the current member name, or to the current value if it is delivered.
+void ExpressLinkJSON::append(char c)
+{
+    if (key)
+    {
+        appendPath(c);
+    }
+    else if (!capture)
+    {
+        return;
+    }
+    else if (textLength < sizeof(text) - 1)
+    {
+        text[textLength++] = c;
+    }
+    else
+    {
+        truncated = true;
+    }
+}
+
+/// @brief Appends the code point of a `\u` escape, encoded as UTF-8. Surrogate pairs are encoded one by one.
+void ExpressLinkJSON::appendUnicode()
+{
+    if (unicode < 0x80)
+    {
+        append((char)unicode);
+    }
+    else if (unicode < 0x800)
+    {
+        append((char)(0xC0 | unicode >> 6));
+        append((char)(0x80 | (unicode & 0x3F)));
+    }
+    else
+    {
+        append((char)(0xE0 | unicode >> 12));
+        append((char)(0x80 | (unicode >> 6 & 0x3F)));
+        append((char)(0x80 | (unicode & 0x3F)));
+    }
+}
+
+/// @brief Appends a character to the path. If it does not fit, the current value and its members are not delivered.
+void ExpressLinkJSON::appendPath(char c)
+{
+    if (pathLength < sizeof(path) - 1)
+    {
+        path[pathLength++] = c;
+        path[pathLength] = '\0';
+    }
+    else if (overflow == 0)
+    {
+        overflow = depth + 1;
+    }
+}
+
+void ExpressLinkJSON::truncatePath(uint8_t length)
+{
+    pathLength = length;
+    path[length] = '\0';
+}
+
+/// @return true if the current path is selected by a filter and fits into `EXPRESSLINK_JSON_PATH`
+bool ExpressLinkJSON::matches() const
+{
+    if (overflow != 0)
+    {
+        return false;
+    }
+    if (filterCount == 0)
+    {
+        return true;
+    }
+    for (uint8_t i = 0; i < filterCount; i++)
+    {
+        if (matchPath(filters[i], path))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Calls the handler with the current path, and the current value for strings, numbers and literals.
+void ExpressLinkJSON::deliver(Type type)
+{
+    bool scalar = type >= StringValue;
+    text[scalar ? textLength : 0] = '\0';
+    const char *separator = strrchr(path, '.');
+    Value value = {type, path, separator ? separator + 1 : path, text, scalar ? textLength : 0, scalar && truncated};
+    handler(*this, value, context);
+}
+
+/// @brief Formats `SHADOW{index} {command}` and streams its document into the parser.
+bool ExpressLinkJSON::shadowGet(ExpressLink &expresslink, uint8_t index, const char *command)
+{
+    char header[32];
+    if (!ExpressLink::shadowHeader(header, sizeof(header), index, command))
+    {
+        return false;
+    }
+    reset();
+    lead = StatusLead;
+    return expresslink.cmdStream(header, sink, this) && state == Done;
+}
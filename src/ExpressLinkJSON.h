@@ -0,0 +1,159 @@
+#pragma once
+
+#include "ExpressLink.h"
+
+/// @brief Maximum nesting depth of objects and arrays parsed by `ExpressLinkJSON`, deeper documents fail to parse.
+#ifndef EXPRESSLINK_JSON_DEPTH
+#define EXPRESSLINK_JSON_DEPTH 8
+#endif
+
+/// @brief Capacity in bytes of the path of the current value, including the null-terminator, at most 256.
+/// Values with longer paths are parsed, but never delivered.
+#ifndef EXPRESSLINK_JSON_PATH
+#define EXPRESSLINK_JSON_PATH 64
+#endif
+
+/// @brief Capacity in bytes of a delivered string or number, including the null-terminator. Longer values are truncated.
+#ifndef EXPRESSLINK_JSON_VALUE
+#define EXPRESSLINK_JSON_VALUE 64
+#endif
+
+/// @brief Number of path filters, see `ExpressLinkJSON::select()`.
+#ifndef EXPRESSLINK_JSON_FILTERS
+#define EXPRESSLINK_JSON_FILTERS 4
+#endif
+
+/// @brief Capacity in bytes of the topic name received by `ExpressLinkJSON::get()`, including the null-terminator.
+#ifndef EXPRESSLINK_JSON_TOPIC
+#define EXPRESSLINK_JSON_TOPIC 64
+#endif
+
+/// @brief Incremental (SAX-style) JSON parser, which calls a handler for every value while the document is received.
+///
+/// The document can be fed in fragments of any size, e.g., straight from the UART with `shadowGetDoc()`,
+/// `shadowGetDelta()` or `get()`, so it is never held in RAM as a whole. Each value is identified by its path of
+/// member names and array indices joined with `.`, e.g., `state.desired.led` or `readings.2`. With path filters, see
+/// `select()`, only the selected values are materialised and delivered, all others are only tokenized.
+class ExpressLinkJSON
+{
+public:
+    enum Type : uint8_t
+    {
+        ObjectStart,  /// `{`, members follow
+        ObjectEnd,    /// `}`
+        ArrayStart,   /// `[`, elements follow
+        ArrayEnd,     /// `]`
+        StringValue,  /// `text` holds the unescaped string
+        NumberValue,  /// `text` holds the number as written
+        BooleanValue, /// `text` is `true` or `false`
+        NullValue,    /// `text` is `null`
+    };
+
+    /// @brief A value delivered to the `Handler`. Strings point into the parser and are valid until the handler returns.
+    struct Value
+    {
+        Type type;
+        const char *path; /// member names and array indices joined with `.`, empty for the top-level value
+        const char *key;  /// last segment of `path`, i.e., the member name or array index
+        const char *text; /// null-terminated value, empty for object and array events
+        size_t length;    /// number of bytes in `text`
+        bool truncated;   /// true if `text` did not fit into `EXPRESSLINK_JSON_VALUE`
+
+        /// @return true if the value is the literal `true`
+        bool toBool() const { return type == BooleanValue && text[0] == 't'; }
+        long toInt() const { return strtol(text, nullptr, 10); }
+        double toFloat() const { return strtod(text, nullptr); }
+    };
+
+    /// @brief Handles a value, see `Value`.
+    typedef void (*Handler)(ExpressLinkJSON &parser, const Value &value, void *context);
+
+    ExpressLinkJSON(Handler handler, void *context = nullptr);
+
+    bool select(const char *path);
+    void selectAll();
+
+    void reset();
+    bool feed(const char *data, size_t length);
+    bool finish();
+    bool parse(const char *json);
+    /// @return true once a complete top-level value was parsed
+    bool done() const { return state == Done; }
+    /// @return true if the document is malformed or nested deeper than `EXPRESSLINK_JSON_DEPTH`
+    bool failed() const { return state == Failed; }
+
+    bool shadowGetDoc(ExpressLink &expresslink, uint8_t index = -1);
+    bool shadowGetDelta(ExpressLink &expresslink, uint8_t index = -1);
+    bool get(ExpressLink &expresslink, uint8_t topic_index = -1);
+    /// @return topic name of the last message received by `get()` with `GET` or `GET0`, otherwise empty
+    const char *topic() const { return topicName; }
+
+    static bool sink(const char *data, size_t length, bool end, void *context);
+
+private:
+    enum State : uint8_t
+    {
+        Start,     /// expecting the top-level value
+        Member,    /// expecting a member name or `}`
+        Colon,     /// expecting `:` after a member name
+        Element,   /// expecting the first array element or `]`
+        Item,      /// expecting a member value or a further array element
+        Next,      /// expecting `,` or the end of the enclosing object or array
+        InString,  /// inside a member name or string value
+        InEscape,  /// after `\` in a string
+        InUnicode, /// inside the hexadecimal digits of `\u`
+        InLiteral, /// inside a number, `true`, `false` or `null`
+        Done,
+        Failed,
+    };
+
+    /// @brief Leading text of a streamed response that is not part of the document.
+    enum Lead : uint8_t
+    {
+        NoLead,     /// the document starts right away
+        StatusLead, /// `1 ` of a shadow response, or `0` if there is no document
+        TopicLead,  /// the topic name line of a `GET` or `GET0` response
+    };
+
+    void step(char c);
+    void beginValue(char c);
+    void endValue();
+    void open(bool object);
+    bool close(bool object);
+    void append(char c);
+    void appendUnicode();
+    void appendPath(char c);
+    void truncatePath(uint8_t length);
+    bool matches() const;
+    void deliver(Type type);
+    bool shadowGet(ExpressLink &expresslink, uint8_t index, const char *command);
+
+    Handler handler;
+    void *context;
+    const char *filters[EXPRESSLINK_JSON_FILTERS];
+    uint8_t filterCount = 0;
+
+    State state = Start;
+    Lead lead = NoLead;
+    bool key = false;       /// true while the current string is a member name
+    bool capture = false;   /// true if the current value is delivered
+    Type literal = NullValue;
+    uint8_t unicodeDigits = 0;
+    uint16_t unicode = 0;
+
+    uint8_t depth = 0;
+    bool objects[EXPRESSLINK_JSON_DEPTH];     /// true for objects, false for arrays, per open container
+    uint8_t bases[EXPRESSLINK_JSON_DEPTH];    /// length of the path of each open container
+    uint16_t indices[EXPRESSLINK_JSON_DEPTH]; /// index of the current element of each open array
+
+    char path[EXPRESSLINK_JSON_PATH];
+    uint8_t pathLength = 0;
+    uint8_t overflow = 0; /// 1 + nesting level of the value whose path did not fit, 0 if none
+
+    char text[EXPRESSLINK_JSON_VALUE];
+    size_t textLength = 0;
+    bool truncated = false;
+
+    char topicName[EXPRESSLINK_JSON_TOPIC];
+    size_t topicLength = 0;
+};
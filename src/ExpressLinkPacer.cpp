@@ -0,0 +1,144 @@
+#include "ExpressLinkPacer.h"
+#include "ExpressLinkSpool.h"
+
+/// @brief Creates a pacer, starting halfway between the rate limits.
+/// @param el ExpressLink interface to publish with
+/// @param minRate lower limit of the publish rate in messages per second, at least 1
+/// @param maxRate upper limit of the publish rate in messages per second
+ExpressLinkPacer::ExpressLinkPacer(ExpressLink &el, uint16_t minRate, uint16_t maxRate)
+    : expresslink(el), minRate(minRate ? minRate : 1), maxRate(maxRate > minRate ? maxRate : this->minRate)
+{
+    current = this->minRate + (this->maxRate - this->minRate) / 2;
+}
+
+/// @brief Sets the parameters of the AIMD controller.
+/// @param increase messages per second added after `rate()` consecutive successful publishes
+/// @param decrease percentage of the rate kept after a congestion signal, e.g., 50 to halve it
+/// @param targetLatency publishes slower than this, in milliseconds, count as congestion
+void ExpressLinkPacer::setControl(uint16_t increase, uint8_t decrease, uint32_t targetLatency)
+{
+    this->increase = increase;
+    this->decreasePercent = decrease < 100 ? decrease : 99;
+    this->targetLatency = targetLatency;
+}
+
+/// @brief Sets the limits of `batchBytes()`.
+/// @param minBytes recommended message size at the maximum rate
+/// @param maxBytes recommended message size at low rates, typically the buffer size of the batch
+void ExpressLinkPacer::setBatchLimits(size_t minBytes, size_t maxBytes)
+{
+    minBatch = minBytes;
+    maxBatch = maxBytes > minBytes ? maxBytes : minBytes;
+}
+
+/// @return true if the next publish is due
+bool ExpressLinkPacer::ready() const
+{
+    return (long)(expresslink.now() - nextSend) >= 0;
+}
+
+/// @brief Schedules the next publish, call it before each publish that is not sent through `publish()`.
+void ExpressLinkPacer::consume()
+{
+    unsigned long now = expresslink.now();
+    nextSend = (ready() ? now : nextSend) + 1000 / current;
+}
+
+/// @brief Feeds the result of a publish into the controller.
+/// Transient errors and timeouts decrease the rate, permanent errors (e.g., an invalid topic) are ignored.
+/// @param success true if the publish succeeded
+/// @param latency duration of the publish in milliseconds
+void ExpressLinkPacer::report(bool success, uint32_t latency)
+{
+    stats.sent++;
+    if (!success)
+    {
+        if (expresslink.lastError().category() & (ExpressLink::Error::Transient | ExpressLink::Error::TimedOut))
+        {
+            stats.errors++;
+            decrease();
+        }
+        return;
+    }
+    if (latency > targetLatency)
+    {
+        stats.slow++;
+        decrease();
+        return;
+    }
+    if (++successes >= current && current < maxRate)
+    {
+        current = (maxRate - current > increase) ? current + increase : maxRate;
+        successes = 0;
+        stats.increases++;
+    }
+}
+
+/// @brief Reports an `OVERRUN` event, which decreases the rate.
+void ExpressLinkPacer::overrun()
+{
+    stats.overruns++;
+    decrease();
+}
+
+/// @brief Event handler forwarding `OVERRUN` events, e.g., `el.onEvent(ExpressLink::OVERRUN, ExpressLinkPacer::onOverrun, &pacer)`.
+void ExpressLinkPacer::onOverrun(ExpressLink &, const ExpressLink::Event &, const char *, void *context)
+{
+    ((ExpressLinkPacer *)context)->overrun();
+}
+
+/// @brief Waits until the next publish is due, then publishes the message and reports the result.
+/// Replaces fixed `delay()` calls between publishes.
+/// @param maxWait longest time to wait for the next publish in milliseconds, 0 to publish only if `ready()`.
+/// The default covers one publish interval at the lowest possible rate.
+/// @return true on success, false on error or if the next publish was not due within `maxWait`, see `ready()`
+bool ExpressLinkPacer::publish(uint8_t topic_index, const char *message, size_t length, uint32_t maxWait)
+{
+    unsigned long waiting = expresslink.now();
+    while (!ready())
+    {
+        if (expresslink.now() - waiting >= maxWait)
+        {
+            return false;
+        }
+        expresslink.idle(nullptr, waiting);
+    }
+    consume();
+    unsigned long started = expresslink.now();
+    bool success = expresslink.publish(topic_index, message, length);
+    report(success, expresslink.now() - started);
+    return success;
+}
+
+/// @brief Same as `publish(uint8_t, const char *, size_t, uint32_t)`, for null-terminated messages.
+bool ExpressLinkPacer::publish(uint8_t topic_index, const char *message)
+{
+    return publish(topic_index, message, strlen(message));
+}
+
+/// @return recommended message size for batching, grows as the rate shrinks to keep the UART busy with fewer commands
+size_t ExpressLinkPacer::batchBytes() const
+{
+    size_t bytes = ExpressLink::BAUDRATE / 10 / current; // 10 bits per byte on the wire
+    return bytes < minBatch ? minBatch : (bytes > maxBatch ? maxBatch : bytes);
+}
+
+/// @return number of messages waiting in the attached `ExpressLinkSpool`, 0 if none is attached
+uint32_t ExpressLinkPacer::backlog() const
+{
+    return spool ? spool->pending() : 0;
+}
+
+/// @brief Cuts the rate multiplicatively, at most once per publish interval, so one congestion episode counts once.
+void ExpressLinkPacer::decrease()
+{
+    successes = 0;
+    if (stats.decreases > 0 && expresslink.now() - lastDecrease < 1000 / current)
+    {
+        return;
+    }
+    uint16_t reduced = (uint32_t)current * decreasePercent / 100;
+    current = reduced > minRate ? reduced : minRate;
+    lastDecrease = expresslink.now();
+    stats.decreases++;
+}
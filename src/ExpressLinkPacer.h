@@ -0,0 +1,69 @@
+#pragma once
+
+#include "ExpressLink.h"
+
+class ExpressLinkSpool;
+
+/// @brief Adapts the publish rate to the capacity of the module and its connection (AIMD).
+///
+/// Publishes are spaced by `1000 / rate()` milliseconds. The rate grows additively after every `rate()` successful
+/// publishes, and is cut multiplicatively after an `OVERRUN` event, a transient `ERR` reply, a timeout, or a publish
+/// slower than the target latency. `batchBytes()` grows while the rate shrinks, so that an `ExpressLinkBatch` using
+/// this pacer keeps the throughput with fewer commands. Use it through `publish()`, or attach it to an
+/// `ExpressLinkSpool` or an `ExpressLinkBatch`, which then queue outbound messages as backlog.
+class ExpressLinkPacer
+{
+public:
+    struct Statistics
+    {
+        uint32_t sent;      /// publishes reported to the pacer
+        uint32_t errors;    /// transient errors and timeouts
+        uint32_t overruns;  /// `OVERRUN` events
+        uint32_t slow;      /// publishes slower than the target latency
+        uint32_t increases; /// additive rate increases
+        uint32_t decreases; /// multiplicative rate decreases
+    };
+
+    ExpressLinkPacer(ExpressLink &el, uint16_t minRate = 1, uint16_t maxRate = 50);
+
+    void setControl(uint16_t increase = 1, uint8_t decrease = 50, uint32_t targetLatency = 500);
+    void setBatchLimits(size_t minBytes, size_t maxBytes);
+
+    bool ready() const;
+    void consume();
+    void report(bool success, uint32_t latency);
+    void overrun();
+    static void onOverrun(ExpressLink &expresslink, const ExpressLink::Event &event, const char *detail, void *context);
+
+    bool publish(uint8_t topic_index, const char *message, size_t length, uint32_t maxWait = 1000);
+    bool publish(uint8_t topic_index, const char *message);
+
+    /// @return current publish rate in messages per second
+    uint16_t rate() const { return current; }
+    size_t batchBytes() const;
+    uint32_t backlog() const;
+    const Statistics &statistics() const { return stats; }
+
+private:
+    friend class ExpressLinkSpool;
+
+    void decrease();
+
+    ExpressLink &expresslink;
+    ExpressLinkSpool *spool = nullptr;
+
+    uint16_t minRate;
+    uint16_t maxRate;
+    uint16_t increase = 1;
+    uint8_t decreasePercent = 50;
+    uint32_t targetLatency = 500;
+    size_t minBatch = 64;
+    size_t maxBatch = 1024;
+
+    uint16_t current;
+    uint16_t successes = 0;
+    unsigned long nextSend = 0;
+    unsigned long lastDecrease = 0;
+
+    Statistics stats = {};
+};
@@ -0,0 +1,501 @@
+#include "ExpressLinkShadow.h"
+
+/// @return `p` advanced past JSON whitespace
+static const char *skipWhitespace(const char *p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+/// @return `p` advanced past the string starting at `p`, which must point to the opening quote
+static const char *skipString(const char *p)
+{
+    for (p++; *p != '\0' && *p != '"'; p++)
+    {
+        if (*p == '\\' && p[1] != '\0')
+        {
+            p++;
+        }
+    }
+    return *p == '"' ? p + 1 : p;
+}
+
+/// @return `p` advanced past the JSON value starting at `p`, nested objects and arrays included
+static const char *skipValue(const char *p)
+{
+    if (*p == '"')
+    {
+        return skipString(p);
+    }
+    if (*p != '{' && *p != '[')
+    {
+        while (*p != '\0' && *p != ',' && *p != '}' && *p != ']' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        {
+            p++;
+        }
+        return p;
+    }
+    int depth = 0;
+    while (*p != '\0')
+    {
+        if (*p == '"')
+        {
+            p = skipString(p);
+            continue;
+        }
+        if (*p == '{' || *p == '[')
+        {
+            depth++;
+        }
+        else if ((*p == '}' || *p == ']') && --depth == 0)
+        {
+            return p + 1;
+        }
+        p++;
+    }
+    return p;
+}
+
+/// @brief Reads the next member of the object at `p`.
+/// @param p position after the opening brace or after the previous member, advanced to the member's value
+/// @param key set to the first character of the member's name, which is not unescaped
+/// @param length set to the length of the member's name
+/// @return false at the end of the object or on malformed JSON
+static bool nextMember(const char *&p, const char *&key, size_t &length)
+{
+    p = skipWhitespace(p);
+    if (*p == ',')
+    {
+        p = skipWhitespace(p + 1);
+    }
+    if (*p != '"')
+    {
+        return false;
+    }
+    const char *end = skipString(p);
+    key = p + 1;
+    length = end - p - 2;
+    p = skipWhitespace(end);
+    if (*p != ':')
+    {
+        return false;
+    }
+    p = skipWhitespace(p + 1);
+    return *p != '\0';
+}
+
+/// @return the value of member `name` of the object starting at `object`, `nullptr` if there is no such member
+static const char *findMember(const char *object, const char *name)
+{
+    object = skipWhitespace(object);
+    if (*object != '{')
+    {
+        return nullptr;
+    }
+    const char *p = object + 1;
+    const char *key;
+    size_t length;
+    while (nextMember(p, key, length))
+    {
+        if (length == strlen(name) && strncmp(key, name, length) == 0)
+        {
+            return p;
+        }
+        p = skipValue(p);
+    }
+    return nullptr;
+}
+
+/// @brief Creates a mirror of one device shadow.
+/// @param el ExpressLink interface to send the shadow commands with
+/// @param index shadow index. Use -1 (default), to select the unnamed shadow.
+ExpressLinkShadow::ExpressLinkShadow(ExpressLink &el, uint8_t index)
+    : expresslink(el), index(index)
+{
+    for (Entry &entry : entries)
+    {
+        entry.key[0] = '\0';
+        entry.dirty = false;
+    }
+}
+
+/// @brief Sets a reported value, which is sent by the next `update()` if it differs from the last one.
+/// @param key top-level key of `state.reported`
+/// @param json raw JSON value, e.g., `21.5`, `"on"` or `{"r":1}`
+/// @return false if the key or the value does not fit into the mirror
+bool ExpressLinkShadow::reportJSON(const char *key, const char *json)
+{
+    Entry *entry = find(key, strlen(key), true);
+    if (entry == nullptr)
+    {
+        return false;
+    }
+    if (entry->reported != json)
+    {
+        if (!entry->reported.reserve(strlen(json)))
+        {
+            stats.overflows++;
+            return false;
+        }
+        entry->reported = json;
+        entry->dirty = true;
+    }
+    return true;
+}
+
+/// @brief Sets a reported integer value, see `reportJSON()`.
+bool ExpressLinkShadow::reportInt(const char *key, long value)
+{
+    char json[21];
+    snprintf(json, sizeof(json), "%ld", value);
+    return reportJSON(key, json);
+}
+
+/// @brief Sets a reported number, see `reportJSON()`.
+/// @param decimals number of decimal places, changes below the last one are not sent
+bool ExpressLinkShadow::reportFloat(const char *key, double value, uint8_t decimals)
+{
+#if EXPRESSLINK_STATIC
+    char json[32];
+#if defined(__AVR__)
+    if (fabs(value) >= 1e9 || decimals > 9) // AVR printf has no floating-point support, and dtostrf() is unbounded
+    {
+        stats.overflows++;
+        return false;
+    }
+    dtostrf(value, 1, decimals, json);
+#else
+    if (snprintf(json, sizeof(json), "%.*f", decimals, value) >= (int)sizeof(json))
+    {
+        stats.overflows++;
+        return false;
+    }
+#endif
+    return reportJSON(key, json);
+#else
+    return reportJSON(key, String(value, decimals).c_str());
+#endif
+}
+
+/// @brief Sets a reported boolean value, see `reportJSON()`.
+bool ExpressLinkShadow::reportBool(const char *key, bool value)
+{
+    return reportJSON(key, value ? "true" : "false");
+}
+
+/// @brief Sets a reported string value, quoted and escaped for JSON, see `reportJSON()`.
+bool ExpressLinkShadow::reportString(const char *key, const char *value)
+{
+    Value json;
+    json.reserve(strlen(value) + 2);
+    json += '"';
+    for (const char *c = value; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            json += '\\';
+            json += *c;
+        }
+        else if (*c == '\n')
+        {
+            json += "\\n";
+        }
+        else if (*c == '\r')
+        {
+            json += "\\r";
+        }
+        else if (*c == '\t')
+        {
+            json += "\\t";
+        }
+        else if ((uint8_t)*c >= 0x20)
+        {
+            json += *c;
+        }
+    }
+    json += '"';
+#if EXPRESSLINK_STATIC
+    if (json.truncated())
+    {
+        stats.overflows++;
+        return false;
+    }
+#endif
+    return reportJSON(key, json.c_str());
+}
+
+/// @return the last reported value of `key` as raw JSON, `nullptr` if unknown
+const char *ExpressLinkShadow::reported(const char *key) const
+{
+    const Entry *entry = find(key);
+    return (entry != nullptr && entry->reported.length() > 0) ? entry->reported.c_str() : nullptr;
+}
+
+/// @return the last desired value of `key` as raw JSON, `nullptr` if unknown
+const char *ExpressLinkShadow::desired(const char *key) const
+{
+    const Entry *entry = find(key);
+    return (entry != nullptr && entry->desired.length() > 0) ? entry->desired.c_str() : nullptr;
+}
+
+uint8_t ExpressLinkShadow::pending() const
+{
+    uint8_t count = 0;
+    for (const Entry &entry : entries)
+    {
+        count += entry.dirty;
+    }
+    return count;
+}
+
+/// @brief Sends the reported values that changed since the last successful update.
+///
+/// Sends `{"state":{"reported":{...}}}` with only the changed keys. No command is sent if nothing changed.
+/// @return true on success or if nothing changed, false on error or if the document does not fit, in which case the changes stay pending
+bool ExpressLinkShadow::update()
+{
+    size_t length = 0;
+    uint8_t count = 0;
+    for (const Entry &entry : entries)
+    {
+        if (entry.dirty)
+        {
+            length += strlen(entry.key) + entry.reported.length() + 4; // quotes, colon and comma
+            count++;
+        }
+    }
+    if (count == 0)
+    {
+        stats.suppressed++;
+        return true;
+    }
+
+    ExpressLinkText doc;
+    if (!doc.reserve(length + 24))
+    {
+        stats.overflows++;
+        return false;
+    }
+    doc += "{\"state\":{\"reported\":{";
+    for (const Entry &entry : entries)
+    {
+        if (entry.dirty)
+        {
+            if (doc[doc.length() - 1] != '{')
+            {
+                doc += ',';
+            }
+            doc += '"';
+            doc += entry.key;
+            doc += "\":";
+            doc += entry.reported.c_str();
+        }
+    }
+    doc += "}}}";
+
+    stats.updates++;
+    if (!expresslink.shadowUpdate(doc.c_str(), doc.length(), index))
+    {
+        return false;
+    }
+    stats.keysSent += count;
+    for (Entry &entry : entries)
+    {
+        entry.dirty = false;
+    }
+    return true;
+}
+
+/// @brief Fetches the shadow document with `SHADOW GET DOC` and merges it, see `mergeDocument()`.
+/// Requires a previous `ExpressLink::shadowDoc()` request.
+/// @return false on error or if no document was received
+bool ExpressLinkShadow::refresh()
+{
+    if (!expresslink.shadowGetDoc(index))
+    {
+        return false;
+    }
+    const char *json = fetched();
+    if (json == nullptr)
+    {
+        return false;
+    }
+    mergeDocument(json);
+    return true;
+}
+
+/// @brief Merges a delta document, as returned by `SHADOW GET DELTA`, into the desired values.
+/// @param json delta document, e.g., `{"version":7,"state":{"led":"on"}}`
+/// @return number of desired values that changed
+uint8_t ExpressLinkShadow::mergeDelta(const char *json)
+{
+    const char *state = findMember(json, "state");
+    return state != nullptr ? mergeObject(state, true) : 0;
+}
+
+/// @brief Merges a full shadow document, as returned by `SHADOW GET DOC`.
+///
+/// `state.desired` is merged into the desired values. `state.reported` is taken as the last reported values, so
+/// `update()` does not send values the cloud already has, but pending values that differ from it are kept.
+/// @return number of desired values that changed
+uint8_t ExpressLinkShadow::mergeDocument(const char *json)
+{
+    const char *state = findMember(json, "state");
+    if (state == nullptr)
+    {
+        return 0;
+    }
+    const char *reported = findMember(state, "reported");
+    if (reported != nullptr)
+    {
+        mergeObject(reported, false);
+    }
+    const char *desired = findMember(state, "desired");
+    return desired != nullptr ? mergeObject(desired, true) : 0;
+}
+
+/// @brief Sets the function called by `mergeDelta()` and `mergeDocument()` for every desired value that changed.
+void ExpressLinkShadow::onDelta(DeltaHandler handler, void *context)
+{
+    this->handler = handler;
+    this->context = context;
+}
+
+/// @brief Event handler that fetches and merges the document or delta of the shadow.
+///
+/// Register it for `SHADOW_DOC` and `SHADOW_DELTA`, with the mirror as context:
+/// `el.onEvent(ExpressLink::SHADOW_DELTA, ExpressLinkShadow::onShadowEvent, &mirror);`
+void ExpressLinkShadow::onShadowEvent(ExpressLink &expresslink, const ExpressLink::Event &event, const char *, void *context)
+{
+    ExpressLinkShadow &shadow = *(ExpressLinkShadow *)context;
+    if (event.parameter != (shadow.index == (uint8_t)-1 ? 0 : shadow.index))
+    {
+        return;
+    }
+    if (event.code == ExpressLink::SHADOW_DOC)
+    {
+        shadow.refresh();
+    }
+    else if (event.code == ExpressLink::SHADOW_DELTA && expresslink.shadowGetDelta(shadow.index))
+    {
+        const char *json = shadow.fetched();
+        if (json != nullptr)
+        {
+            shadow.mergeDelta(json);
+        }
+    }
+}
+
+/// @return the entry of `key`, a new entry if `create` is true and there is room, otherwise `nullptr`
+ExpressLinkShadow::Entry *ExpressLinkShadow::find(const char *key, size_t length, bool create)
+{
+    if (length == 0 || length >= EXPRESSLINK_SHADOW_KEY)
+    {
+        stats.overflows += create;
+        return nullptr;
+    }
+    Entry *unused = nullptr;
+    for (Entry &entry : entries)
+    {
+        if (entry.key[0] == '\0')
+        {
+            unused = unused ? unused : &entry;
+        }
+        else if (strncmp(entry.key, key, length) == 0 && entry.key[length] == '\0')
+        {
+            return &entry;
+        }
+    }
+    if (!create || unused == nullptr)
+    {
+        stats.overflows += create;
+        return nullptr;
+    }
+    memcpy(unused->key, key, length);
+    unused->key[length] = '\0';
+    return unused;
+}
+
+const ExpressLinkShadow::Entry *ExpressLinkShadow::find(const char *key) const
+{
+    for (const Entry &entry : entries)
+    {
+        if (entry.key[0] != '\0' && strcmp(entry.key, key) == 0)
+        {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+/// @brief Merges the members of a JSON object into the desired or reported values.
+/// @return number of values that changed
+uint8_t ExpressLinkShadow::mergeObject(const char *object, bool desired)
+{
+    object = skipWhitespace(object);
+    if (*object != '{')
+    {
+        return 0;
+    }
+    uint8_t changed = 0;
+    const char *p = object + 1;
+    const char *key;
+    size_t length;
+    while (nextMember(p, key, length))
+    {
+        const char *value = p;
+        p = skipValue(p);
+        Entry *entry = find(key, length, true);
+        if (entry == nullptr)
+        {
+            continue;
+        }
+        Value &current = desired ? entry->desired : entry->reported;
+        if (current.length() == (size_t)(p - value) && strncmp(current.c_str(), value, p - value) == 0)
+        {
+            if (!desired)
+            {
+                entry->dirty = false; // the pending value reached the cloud by other means
+            }
+            continue;
+        }
+        if (!desired && entry->dirty)
+        {
+            continue; // keep the newer local value
+        }
+        if (!current.reserve(p - value))
+        {
+            stats.overflows++;
+            continue;
+        }
+        current = "";
+        for (const char *c = value; c < p; c++)
+        {
+            current += *c;
+        }
+        if (desired)
+        {
+            changed++;
+            stats.merges++;
+            if (handler != nullptr)
+            {
+                handler(*this, entry->key, current.c_str(), context);
+            }
+        }
+    }
+    return changed;
+}
+
+/// @return the document of the last `SHADOW GET` response, `nullptr` if none was received
+const char *ExpressLinkShadow::fetched()
+{
+    const ExpressLinkText &response = expresslink.response;
+    if (!response.startsWith("1 "))
+    {
+        return nullptr;
+    }
+    return response.c_str() + 2;
+}
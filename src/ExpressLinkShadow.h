@@ -0,0 +1,96 @@
+#pragma once
+
+#include "ExpressLink.h"
+
+/// @brief Number of top-level keys tracked by an `ExpressLinkShadow`.
+#ifndef EXPRESSLINK_SHADOW_KEYS
+#define EXPRESSLINK_SHADOW_KEYS 16
+#endif
+
+/// @brief Capacity in bytes of a key tracked by an `ExpressLinkShadow`, including the null-terminator.
+#ifndef EXPRESSLINK_SHADOW_KEY
+#define EXPRESSLINK_SHADOW_KEY 24
+#endif
+
+/// @brief Capacity in bytes of each reported and desired value with `EXPRESSLINK_STATIC`, including the null-terminator.
+/// Longer values are ignored and counted in `ExpressLinkShadow::Statistics::overflows`.
+#ifndef EXPRESSLINK_SHADOW_VALUE
+#define EXPRESSLINK_SHADOW_VALUE 32
+#endif
+
+/// @brief Local mirror of a device shadow, which sends only changed reported values and merges desired values.
+///
+/// The mirror tracks the top-level keys of `state.reported` and `state.desired`, with each value kept as raw JSON
+/// text (a number, string, boolean, null, or a nested object or array as a whole). `update()` sends only the
+/// reported keys that changed since the last successful update, and nothing at all if none changed.
+/// `mergeDelta()` and `mergeDocument()` apply `SHADOW GET DELTA` and `SHADOW GET DOC` results, and call the
+/// delta handler for every desired value that changed.
+///
+/// With `EXPRESSLINK_STATIC`, the values are fixed-capacity strings, and `update()` builds the document in an
+/// `ExpressLinkText` on the stack, i.e., in `EXPRESSLINK_MAX_LINE` bytes.
+class ExpressLinkShadow
+{
+public:
+    /// @brief Handles a desired value that changed, see `onDelta()`.
+    /// @param value raw JSON value, e.g., `21.5`, `"on"` or `{"r":1}`
+    typedef void (*DeltaHandler)(ExpressLinkShadow &shadow, const char *key, const char *value, void *context);
+
+    struct Statistics
+    {
+        uint32_t updates;    /// `SHADOW UPDATE` commands sent
+        uint32_t suppressed; /// `update()` calls without changes, no command was sent
+        uint32_t keysSent;   /// reported keys sent in updates
+        uint32_t merges;     /// desired values changed by merges
+        uint32_t overflows;  /// keys ignored because the mirror was full or the key or value was too long
+    };
+
+    ExpressLinkShadow(ExpressLink &el, uint8_t index = -1);
+
+    bool reportJSON(const char *key, const char *json);
+    bool reportInt(const char *key, long value);
+    bool reportFloat(const char *key, double value, uint8_t decimals = 2);
+    bool reportBool(const char *key, bool value);
+    bool reportString(const char *key, const char *value);
+
+    const char *reported(const char *key) const;
+    const char *desired(const char *key) const;
+    /// @return number of reported keys that changed since the last successful `update()`
+    uint8_t pending() const;
+
+    bool update();
+    bool refresh();
+    uint8_t mergeDelta(const char *json);
+    uint8_t mergeDocument(const char *json);
+
+    void onDelta(DeltaHandler handler, void *context = nullptr);
+    static void onShadowEvent(ExpressLink &expresslink, const ExpressLink::Event &event, const char *detail, void *context);
+
+    const Statistics &statistics() const { return stats; }
+
+private:
+#if EXPRESSLINK_STATIC
+    typedef ExpressLinkString<EXPRESSLINK_SHADOW_VALUE> Value;
+#else
+    typedef String Value;
+#endif
+
+    struct Entry
+    {
+        char key[EXPRESSLINK_SHADOW_KEY]; /// empty if unused
+        Value reported;
+        Value desired;
+        bool dirty; /// true if `reported` has not been sent yet
+    };
+
+    Entry *find(const char *key, size_t length, bool create);
+    const Entry *find(const char *key) const;
+    uint8_t mergeObject(const char *object, bool desired);
+    const char *fetched();
+
+    ExpressLink &expresslink;
+    uint8_t index;
+    Entry entries[EXPRESSLINK_SHADOW_KEYS];
+    DeltaHandler handler = nullptr;
+    void *context = nullptr;
+    Statistics stats = {};
+};
@@ -0,0 +1,271 @@
+#include "ExpressLinkSpool.h"
+
+/// @brief Creates a spool in RAM.
+/// @param el ExpressLink interface to publish with
+/// @param buffer storage for the spooled messages, must stay valid for the lifetime of the spool
+/// @param size capacity of `buffer` in bytes, each message takes `RECORD_HEADER` bytes in addition to its payload
+ExpressLinkSpool::ExpressLinkSpool(ExpressLink &el, uint8_t *buffer, size_t size)
+    : expresslink(el), buffer(buffer), size(size)
+{
+    // constructor
+}
+
+/// @brief Creates a spool in caller-provided storage, e.g., a flash partition or a file.
+/// @param el ExpressLink interface to publish with
+/// @param size capacity of the storage in bytes, each message takes `RECORD_HEADER` bytes in addition to its payload
+/// @param reader reads from the storage
+/// @param writer writes to the storage
+/// @param context optional pointer passed to `reader` and `writer`
+ExpressLinkSpool::ExpressLinkSpool(ExpressLink &el, uint32_t size, Reader reader, Writer writer, void *context)
+    : expresslink(el), size(size), reader(reader), writer(writer), context(context)
+{
+    // constructor
+}
+
+/// @brief Sets how the spool behaves when it is full, and how fast it is replayed.
+/// @param overflow policy for new messages that do not fit
+/// @param interval minimum time in milliseconds between two replayed messages, 0 to replay one message per `poll()`
+void ExpressLinkSpool::setPolicy(Overflow overflow, uint32_t interval)
+{
+    this->overflow = overflow;
+    this->interval = interval;
+}
+
+/// @brief Paces publishes and replays with an adaptive rate instead of the fixed replay interval.
+/// Messages published faster than the pacer allows are spooled as its backlog, see `ExpressLinkPacer::backlog()`.
+/// @param pacer pacer to use, `nullptr` to use the replay interval again
+void ExpressLinkSpool::setPacer(ExpressLinkPacer *pacer)
+{
+    if (this->pacer != nullptr)
+    {
+        this->pacer->spool = nullptr;
+    }
+    this->pacer = pacer;
+    if (pacer != nullptr)
+    {
+        pacer->spool = this;
+    }
+}
+
+/// @brief Publishes a message, or spools it while disconnected, see `publish(uint8_t, const char *, size_t)`.
+/// @return true if published or spooled, false if the message was rejected
+bool ExpressLinkSpool::publish(uint8_t topic_index, const char *message)
+{
+    return publish(topic_index, message, strlen(message));
+}
+
+/// @brief Publishes a message if connected and no older messages are waiting, otherwise appends it to the spool.
+/// A message that fails to publish with a transient error or a timeout is spooled as well, to be replayed by `poll()`.
+/// @param topic_index the topic index to publish to
+/// @param message raw message to publish, typically JSON-encoded
+/// @param length number of bytes in `message`, at most 65535
+/// @return true if published or spooled, false if the message was rejected by the module or the spool
+bool ExpressLinkSpool::publish(uint8_t topic_index, const char *message, size_t length)
+{
+    if (count == 0 && connected() && (pacer == nullptr || pacer->ready()))
+    {
+        if (pacer ? pacer->publish(topic_index, message, length) : expresslink.publish(topic_index, message, length))
+        {
+            return true;
+        }
+        if (expresslink.lastError().category() == ExpressLink::Error::Permanent)
+        {
+            return false;
+        }
+    }
+    return append(topic_index, message, length);
+}
+
+#if !EXPRESSLINK_STATIC
+/// @brief Publishes a message, or spools it while disconnected, see `publish(uint8_t, const char *, size_t)`.
+/// @return true if published or spooled, false if the message was rejected
+bool ExpressLinkSpool::publish(uint8_t topic_index, const String &message)
+{
+    return publish(topic_index, message.c_str(), message.length());
+}
+#endif
+
+/// @brief Replays the oldest spooled message while connected, at most once per replay interval or when the pacer is ready.
+/// Call it from `loop()`.
+/// @return false if a replay failed
+bool ExpressLinkSpool::poll()
+{
+    if (count == 0 || !connected())
+    {
+        return true;
+    }
+    if (pacer ? !pacer->ready() : expresslink.now() - lastReplay < interval)
+    {
+        return true;
+    }
+    lastReplay = expresslink.now();
+    return replay();
+}
+
+/// @brief Uses the tracked connection state, which is only queried from the module once, if nothing has updated it yet.
+/// @return true if connected
+bool ExpressLinkSpool::connected()
+{
+    if (!statusQueried && expresslink.lastConnectionStatus().updated == 0)
+    {
+        statusQueried = true;
+        return expresslink.connectionStatus().connected;
+    }
+    return expresslink.lastConnectionStatus().connected;
+}
+
+/// @brief Discards all spooled messages.
+void ExpressLinkSpool::clear()
+{
+    head = 0;
+    usedBytes = 0;
+    count = 0;
+}
+
+bool ExpressLinkSpool::append(uint8_t topic_index, const char *message, size_t length)
+{
+    uint32_t record = RECORD_HEADER + length;
+    if (length > 0xFFFF || record > size)
+    {
+        stats.rejected++;
+        return false;
+    }
+    while (size - usedBytes < record)
+    {
+        if (overflow == DropNewest)
+        {
+            stats.rejected++;
+            return false;
+        }
+        discard();
+        stats.overwritten++;
+    }
+
+    const uint8_t header[RECORD_HEADER] = {topic_index, (uint8_t)length, (uint8_t)(length >> 8)};
+    uint32_t tail = head + usedBytes;
+    if (!store(tail, header, RECORD_HEADER) || !store(tail + RECORD_HEADER, (const uint8_t *)message, length))
+    {
+        stats.rejected++;
+        return false;
+    }
+    usedBytes += record;
+    count++;
+    stats.spooled++;
+    if (usedBytes > stats.peak)
+    {
+        stats.peak = usedBytes;
+    }
+    return true;
+}
+
+/// @brief Publishes the oldest message, streaming its payload from the storage.
+/// It is removed on success, or if the module refuses it with a permanent error. It is kept if reading it from the
+/// storage failed, even if the module accepted the truncated payload.
+bool ExpressLinkSpool::replay()
+{
+    uint8_t header[RECORD_HEADER];
+    if (!load(head, header, RECORD_HEADER))
+    {
+        stats.failures++;
+        return false;
+    }
+    replayOffset = head + RECORD_HEADER;
+    replayRemaining = header[1] | (header[2] << 8);
+    if (pacer != nullptr)
+    {
+        pacer->consume();
+    }
+    readFailed = false;
+    unsigned long started = expresslink.now();
+    bool success = expresslink.publish(header[0], produce, this);
+    if (pacer != nullptr)
+    {
+        pacer->report(success, expresslink.now() - started);
+    }
+    if (readFailed)
+    {
+        stats.failures++; // the payload was cut short, keep the message for the next replay
+        return false;
+    }
+    if (success)
+    {
+        discard();
+        stats.replayed++;
+        return true;
+    }
+    if (expresslink.lastError().category() == ExpressLink::Error::Permanent)
+    {
+        discard();
+        stats.rejected++;
+    }
+    else
+    {
+        stats.failures++;
+    }
+    return false;
+}
+
+/// @brief Removes the oldest message. Clears the spool if its record cannot be read.
+void ExpressLinkSpool::discard()
+{
+    uint8_t header[RECORD_HEADER];
+    if (!load(head, header, RECORD_HEADER))
+    {
+        clear();
+        return;
+    }
+    uint32_t record = RECORD_HEADER + (header[1] | (header[2] << 8));
+    head = (head + record) % size;
+    usedBytes -= record;
+    count--;
+}
+
+/// @brief Reads from the storage, splitting ranges that wrap around its end.
+/// @param offset position in the ring, may exceed `size`
+bool ExpressLinkSpool::load(uint32_t offset, uint8_t *data, size_t length)
+{
+    offset %= size;
+    size_t first = (length < size - offset) ? length : size - offset;
+    if (buffer != nullptr)
+    {
+        memcpy(data, buffer + offset, first);
+        memcpy(data + first, buffer, length - first);
+        return true;
+    }
+    return reader(offset, data, first, context) && (first == length || reader(0, data + first, length - first, context));
+}
+
+/// @brief Writes to the storage, splitting ranges that wrap around its end.
+/// @param offset position in the ring, may exceed `size`
+bool ExpressLinkSpool::store(uint32_t offset, const uint8_t *data, size_t length)
+{
+    offset %= size;
+    size_t first = (length < size - offset) ? length : size - offset;
+    if (buffer != nullptr)
+    {
+        memcpy(buffer + offset, data, first);
+        memcpy(buffer, data + first, length - first);
+        return true;
+    }
+    return writer(offset, data, first, context) && (first == length || writer(0, data + first, length - first, context));
+}
+
+/// @brief Streams the payload of the message being replayed, see `ExpressLink::Command::Producer`.
+/// A storage read error ends the payload early and sets `readFailed`, as the command line cannot be taken back.
+size_t ExpressLinkSpool::produce(uint8_t *buffer, size_t size, void *context)
+{
+    ExpressLinkSpool *spool = (ExpressLinkSpool *)context;
+    size_t n = (spool->replayRemaining < size) ? spool->replayRemaining : size;
+    if (n == 0)
+    {
+        return 0;
+    }
+    if (!spool->load(spool->replayOffset, buffer, n))
+    {
+        spool->readFailed = true;
+        return 0;
+    }
+    spool->replayOffset += n;
+    spool->replayRemaining -= n;
+    return n;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "ExpressLink.h"
+#include "ExpressLinkPacer.h"
+
+/// @brief Stores messages published while the connection is lost, and replays them after reconnecting.
+///
+/// Messages are appended as `{topic index}{length}{payload}` records to a bounded ring buffer, either in a
+/// caller-supplied RAM buffer or in caller-provided storage (e.g., a flash partition or a file), accessed through
+/// `Reader` and `Writer` callbacks. Once `ExpressLink::lastConnectionStatus()` reports a connection, `poll()`
+/// replays the oldest message at most once per replay interval, streaming it from the storage to the UART.
+/// The tracked connection state is updated by `connect()`, `connectionStatus()` and connection events; if nothing
+/// has updated it yet, e.g., as the module was already connected when the host started, the first `publish()` or
+/// `poll()` queries it with `CONNECT?`. A `NOT CONNECTED` error marks the connection as lost, so replays pause until
+/// it is connected again.
+/// The spool position is kept in RAM, spooled messages do not survive a reboot of the host.
+class ExpressLinkSpool
+{
+public:
+    enum Overflow : uint8_t
+    {
+        OverwriteOldest = 0, /// discard the oldest messages to make room for a new one
+        DropNewest = 1,      /// reject new messages while the spool is full
+    };
+
+    struct Statistics
+    {
+        uint32_t spooled;     /// messages appended to the spool
+        uint32_t replayed;    /// spooled messages published after reconnecting
+        uint32_t overwritten; /// spooled messages discarded to make room, see `OverwriteOldest`
+        uint32_t rejected;    /// messages not spooled (too large, or spool full with `DropNewest`), or refused by the module on replay
+        uint32_t failures;    /// failed replay attempts, the message is kept and tried again
+        uint32_t peak;        /// maximum number of bytes used
+    };
+
+    /// @brief Reads `length` bytes at `offset` of the spool storage. The range never wraps around the end of the storage.
+    /// @return true on success
+    typedef bool (*Reader)(uint32_t offset, uint8_t *data, size_t length, void *context);
+    /// @brief Writes `length` bytes at `offset` of the spool storage. The range never wraps around the end of the storage.
+    /// @return true on success
+    typedef bool (*Writer)(uint32_t offset, const uint8_t *data, size_t length, void *context);
+
+    /// @brief Bytes stored in front of each payload: the topic index and the payload length (16-bit, little-endian).
+    static const size_t RECORD_HEADER = 3;
+
+    ExpressLinkSpool(ExpressLink &el, uint8_t *buffer, size_t size);
+    ExpressLinkSpool(ExpressLink &el, uint32_t size, Reader reader, Writer writer, void *context = nullptr);
+
+    void setPolicy(Overflow overflow, uint32_t interval = 100);
+    void setPacer(ExpressLinkPacer *pacer);
+
+    bool publish(uint8_t topic_index, const char *message);
+    bool publish(uint8_t topic_index, const char *message, size_t length);
+#if !EXPRESSLINK_STATIC
+    bool publish(uint8_t topic_index, const String &message);
+#endif
+    bool poll();
+    void clear();
+
+    /// @return number of messages waiting in the spool
+    uint32_t pending() const { return count; }
+    /// @return number of bytes used in the spool storage, including record headers
+    uint32_t used() const { return usedBytes; }
+    const Statistics &statistics() const { return stats; }
+
+private:
+    bool connected();
+    bool append(uint8_t topic_index, const char *message, size_t length);
+    bool replay();
+    void discard();
+    bool load(uint32_t offset, uint8_t *data, size_t length);
+    bool store(uint32_t offset, const uint8_t *data, size_t length);
+    static size_t produce(uint8_t *buffer, size_t size, void *context);
+
+    ExpressLink &expresslink;
+    uint8_t *buffer = nullptr;
+    uint32_t size;
+    Reader reader = nullptr;
+    Writer writer = nullptr;
+    void *context = nullptr;
+
+    Overflow overflow = OverwriteOldest;
+    uint32_t interval = 100;
+    ExpressLinkPacer *pacer = nullptr;
+
+    uint32_t head = 0;
+    uint32_t usedBytes = 0;
+    uint32_t count = 0;
+    unsigned long lastReplay = 0;
+    bool statusQueried = false;
+
+    /// @brief position and remaining bytes of the payload currently streamed by `produce()`
+    uint32_t replayOffset = 0;
+    uint32_t replayRemaining = 0;
+    /// @brief set by `produce()` if the storage could not be read, the replayed payload was truncated
+    bool readFailed = false;
+
+    Statistics stats = {};
+};
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Arduino.h"
+
+/// @brief Null-terminated string of up to `N - 1` bytes, stored in place without any heap allocation.
+///
+/// Provides the subset of the Arduino `String` interface used by `ExpressLink`, so it replaces `String` for
+/// `ExpressLink::response`, `ExpressLink::error` and the configuration values if `EXPRESSLINK_STATIC` is set.
+/// Values that do not fit are truncated, see `truncated()`.
+template <size_t N>
+class ExpressLinkString
+{
+public:
+    ExpressLinkString() {}
+    ExpressLinkString(const char *value) { assign(value, strlen(value)); }
+    ExpressLinkString(const ExpressLinkString &value) { assign(value.buffer, value.used); }
+
+    ExpressLinkString &operator=(const char *value)
+    {
+        assign(value, strlen(value));
+        return *this;
+    }
+
+    ExpressLinkString &operator=(const ExpressLinkString &value)
+    {
+        assign(value.buffer, value.used);
+        return *this;
+    }
+
+    ExpressLinkString &operator+=(char c)
+    {
+        concat(&c, 1);
+        return *this;
+    }
+
+    ExpressLinkString &operator+=(const char *value)
+    {
+        concat(value, strlen(value));
+        return *this;
+    }
+
+    /// @brief Appends `length` bytes of `value`, as many as fit.
+    /// @return false if `value` was truncated
+    bool concat(const char *value, size_t length)
+    {
+        size_t n = (length < N - 1 - used) ? length : N - 1 - used;
+        memmove(buffer + used, value, n);
+        used += n;
+        buffer[used] = '\0';
+        overflow = overflow || n < length;
+        return n == length;
+    }
+
+    /// @return true if the string can hold `size` bytes, nothing is allocated
+    bool reserve(size_t size) const { return size < N; }
+    /// @return maximum number of bytes, excluding the null-terminator
+    static size_t capacity() { return N - 1; }
+    /// @return true if bytes were dropped since the last assignment, as they did not fit
+    bool truncated() const { return overflow; }
+
+    const char *c_str() const { return buffer; }
+    char *begin() { return buffer; }
+    char *end() { return buffer + used; }
+    size_t length() const { return used; }
+    char charAt(size_t index) const { return index < used ? buffer[index] : '\0'; }
+    char operator[](size_t index) const { return charAt(index); }
+    /// @return reference to the byte at `index`, or to a scratch byte if `index` is out of range, so writing to it
+    /// never touches the null-terminator
+    char &operator[](size_t index)
+    {
+        if (index < used)
+        {
+            return buffer[index];
+        }
+        scratch = '\0';
+        return scratch;
+    }
+
+    bool equals(const char *value) const { return strcmp(buffer, value) == 0; }
+    bool operator==(const char *value) const { return equals(value); }
+    bool operator!=(const char *value) const { return !equals(value); }
+    bool operator==(const ExpressLinkString &value) const { return equals(value.buffer); }
+    bool operator!=(const ExpressLinkString &value) const { return !equals(value.buffer); }
+    bool startsWith(const char *prefix) const { return strncmp(buffer, prefix, strlen(prefix)) == 0; }
+
+    /// @return index of the first `c` at or after `from`, -1 if there is none
+    int indexOf(char c, size_t from = 0) const
+    {
+        const char *found = (from < used) ? (const char *)memchr(buffer + from, c, used - from) : nullptr;
+        return found ? found - buffer : -1;
+    }
+
+    long toInt() const { return strtol(buffer, nullptr, 10); }
+    float toFloat() const { return strtod(buffer, nullptr); }
+
+    /// @brief Removes everything from `index` to the end.
+    void remove(size_t index) { remove(index, used); }
+
+    /// @brief Removes `count` bytes starting at `index`.
+    void remove(size_t index, size_t count)
+    {
+        if (index >= used)
+        {
+            return;
+        }
+        if (count > used - index)
+        {
+            count = used - index;
+        }
+        memmove(buffer + index, buffer + index + count, used - index - count);
+        used -= count;
+        buffer[used] = '\0';
+    }
+
+    /// @brief Removes leading and trailing whitespace.
+    void trim()
+    {
+        size_t end = used;
+        while (end > 0 && isspace((unsigned char)buffer[end - 1]))
+        {
+            end--;
+        }
+        size_t start = 0;
+        while (start < end && isspace((unsigned char)buffer[start]))
+        {
+            start++;
+        }
+        remove(end);
+        remove(0, start);
+    }
+
+private:
+    /// @brief Replaces the contents, `value` may point into this string.
+    void assign(const char *value, size_t length)
+    {
+        size_t n = (length < N - 1) ? length : N - 1;
+        memmove(buffer, value, n);
+        used = n;
+        buffer[used] = '\0';
+        overflow = n < length;
+    }
+
+    char buffer[N] = {};
+    size_t used = 0;
+    bool overflow = false;
+    char scratch = '\0';
+};
@@ -0,0 +1,687 @@
+#include "ExpressLinkSimulator.h"
+
+/// @brief configuration keys, the first `READ_ONLY_KEYS` cannot be written
+static const char *const defaultKeys[] = {
+    "About", "Version", "TechSpec", "ThingName", "Certificate",
+    "CustomName", "Endpoint", "RootCA", "ShadowToken", "DefenderPeriod", "HOTAcertificate", "OTAcertificate",
+    "SSID", "Passphrase", "APN", "Shadow1", "Shadow2", "Shadow3"};
+static const uint8_t READ_ONLY_KEYS = 5;
+
+/// @brief Parses a decimal index at `pos`, advancing `pos` past it.
+/// @return the index, or -1 if there are no digits at `pos`
+static int parseIndex(const String &s, unsigned int &pos)
+{
+    int index = -1;
+    while (pos < s.length() && isDigit(s.charAt(pos)))
+    {
+        index = (index < 0 ? 0 : index * 10) + (s.charAt(pos) - '0');
+        pos++;
+    }
+    return index;
+}
+
+ExpressLinkSimulator::ExpressLinkSimulator()
+{
+    uint8_t n = 0;
+    for (const char *key : defaultKeys)
+    {
+        keys[n++] = key;
+    }
+    for (uint8_t i = 1; i <= TOPICS; i++)
+    {
+        keys[n++] = "Topic" + String(i);
+    }
+    values[0] = "ExpressLink Simulator";
+    values[1] = "1.0.0";
+    values[2] = "v1.1.0";
+    values[3] = "simulator";
+    values[findKey("DefenderPeriod")] = "0";
+    for (Topic &topic : topics)
+    {
+        topic.subscribed = false;
+        topic.head = 0;
+        topic.count = 0;
+    }
+    for (Shadow &shadow : shadows)
+    {
+        shadow.subscribed = false;
+    }
+}
+
+/// @brief Sets the processing time of every command, before its response starts.
+/// @param latency in milliseconds
+void ExpressLinkSimulator::setLatency(uint32_t latency)
+{
+    this->latency = latency * 1000;
+}
+
+/// @brief Limits the speed of commands and responses to the UART baud rate, with 10 bits per byte.
+/// @param baud e.g., `ExpressLink::BAUDRATE`, 0 for no limit
+void ExpressLinkSimulator::setBaudRate(uint32_t baud)
+{
+    byteTime = baud ? 10000000UL / baud : 0;
+}
+
+/// @brief Emulates the receive buffer of a UART driver: response bytes that arrive while `size` bytes are waiting to
+/// be read are lost, see `bytesDropped()`. Use it together with `setBaudRate()`.
+/// @param size in bytes, 0 for no limit
+void ExpressLinkSimulator::setReceiveBuffer(size_t size)
+{
+    receiveBuffer = size;
+}
+
+/// @brief Proposes a host OTA update with the given image and raises an `OTA` event.
+void ExpressLinkSimulator::setHostImage(const uint8_t *data, size_t size)
+{
+    imageSize = size < sizeof(image) ? size : sizeof(image);
+    memcpy(image, data, imageSize);
+    imageOffset = 0;
+    otaState = ExpressLink::HostUpdateProposed;
+    pushEvent(ExpressLink::OTA, 0, "OTA");
+}
+
+/// @brief Stores a delta document for `SHADOW GET DELTA`, raising a `SHADOW_DELTA` event if subscribed.
+void ExpressLinkSimulator::setShadowDelta(uint8_t index, const String &delta)
+{
+    if (index >= SHADOWS)
+    {
+        return;
+    }
+    shadows[index].delta = delta;
+    if (shadows[index].subscribed)
+    {
+        pushEvent(ExpressLink::SHADOW_DELTA, index, "SHADOW_DELTA");
+    }
+}
+
+/// @brief Simulates an unexpected loss of the connection, raising a `CONLOST` event.
+void ExpressLinkSimulator::dropConnection()
+{
+    if (online)
+    {
+        online = false;
+        pushEvent(ExpressLink::CONLOST, 0, "CONLOST");
+    }
+}
+
+/// @brief Queues an event for `AT+EVENT?`, discarding the oldest event if the queue is full.
+void ExpressLinkSimulator::pushEvent(ExpressLink::EventCode code, int parameter, const char *mnemonic, const String &detail)
+{
+    if (eventCount == EVENTS)
+    {
+        eventHead = (eventHead + 1) % EVENTS;
+        eventCount--;
+    }
+    String event = String((int)code) + " " + String(parameter) + " " + mnemonic;
+    if (detail.length() > 0)
+    {
+        event += " " + detail;
+    }
+    events[(eventHead + eventCount) % EVENTS] = event;
+    eventCount++;
+}
+
+/// @return value of a configuration key, empty if unknown
+String ExpressLinkSimulator::getConfig(const String &key) const
+{
+    int i = findKey(key);
+    return i >= 0 ? values[i] : String();
+}
+
+/// @brief Sets a configuration key, including read-only keys.
+/// @return false if the key is unknown
+bool ExpressLinkSimulator::setConfig(const String &key, const String &value)
+{
+    int i = findKey(key);
+    if (i < 0)
+    {
+        return false;
+    }
+    values[i] = value;
+    return true;
+}
+
+int ExpressLinkSimulator::available()
+{
+    while (segmentCount > 0)
+    {
+        const Segment &segment = segments[segmentHead];
+        if (outputPos >= segment.end)
+        {
+            segmentHead = (segmentHead + 1) % SEGMENTS;
+            segmentCount--;
+            continue;
+        }
+        long elapsed = (long)(micros() - segment.start);
+        if (elapsed < 0)
+        {
+            return 0;
+        }
+        size_t released = byteTime ? elapsed / byteTime : segment.end - segment.begin;
+        size_t ready = segment.begin + (released < segment.end - segment.begin ? released : segment.end - segment.begin);
+        if (receiveBuffer > 0 && ready > outputPos + receiveBuffer)
+        {
+            // the bytes after a full buffer are lost, the following ones arrive at their original time
+            size_t cut = outputPos + receiveBuffer;
+            size_t lost = ready - cut;
+            output.remove(cut, lost);
+            dropped += lost;
+            for (uint8_t i = 0; i < segmentCount; i++)
+            {
+                Segment &other = segments[(segmentHead + i) % SEGMENTS];
+                if (other.begin >= ready)
+                {
+                    other.begin -= lost;
+                }
+                other.end -= lost;
+            }
+            segments[segmentHead].start += lost * byteTime;
+            ready = cut;
+        }
+        return ready > outputPos ? ready - outputPos : 0;
+    }
+    return 0;
+}
+
+int ExpressLinkSimulator::read()
+{
+    int c = peek();
+    if (c >= 0)
+    {
+        outputPos++;
+    }
+    return c;
+}
+
+int ExpressLinkSimulator::peek()
+{
+    return available() > 0 ? (uint8_t)output.charAt(outputPos) : -1;
+}
+
+/// @brief Receives a byte from the host, and executes the command once its line is complete.
+size_t ExpressLinkSimulator::write(uint8_t c)
+{
+    received++;
+    unsigned long now = micros();
+    inputDone = ((long)(inputDone - now) > 0 ? inputDone : now) + byteTime;
+    if (c == '\n')
+    {
+        if (input.endsWith("\r"))
+        {
+            input.remove(input.length() - 1);
+        }
+        execute(input);
+        input = "";
+    }
+    else
+    {
+        input += (char)c;
+    }
+    return 1;
+}
+
+void ExpressLinkSimulator::execute(const String &command)
+{
+    executed++;
+    if (command == "AT")
+    {
+        ok();
+        return;
+    }
+    if (!command.startsWith("AT+"))
+    {
+        fail(ExpressLink::Error::ParseError, "PARSE ERROR");
+        return;
+    }
+    String c = command.substring(3);
+    unsigned int pos;
+
+    if (c.startsWith("CONF"))
+    {
+        executeConf(c.substring(4));
+    }
+    else if (c == "CONNECT?")
+    {
+        bool onboarded = getConfig("Endpoint").length() > 0;
+        ok(String(online ? "1 " : "0 ") + (onboarded ? "1 " : "0 ") + (online ? "CONNECTED " : "DISCONNECTED ") + (onboarded ? "CUSTOMER" : "STAGING"));
+    }
+    else if (c == "CONNECT!")
+    {
+        online = true;
+        ok();
+        pushEvent(ExpressLink::CONNECT, 0, "CONNECT");
+    }
+    else if (c == "CONNECT")
+    {
+        online = true;
+        ok("1 CONNECTED");
+    }
+    else if (c == "DISCONNECT")
+    {
+        online = false;
+        ok("0 DISCONNECTED");
+    }
+    else if (c.startsWith("SEND"))
+    {
+        pos = 4;
+        int index = parseIndex(c, pos);
+        executeSend(index < 0 ? 0 : index, c.substring(pos < c.length() ? pos + 1 : pos));
+    }
+    else if (c.startsWith("GET"))
+    {
+        pos = 3;
+        executeGet(parseIndex(c, pos));
+    }
+    else if (c.startsWith("SUBSCRIBE") || c.startsWith("UNSUBSCRIBE"))
+    {
+        bool subscribe = c.charAt(0) == 'S';
+        pos = subscribe ? 9 : 11;
+        int index = parseIndex(c, pos);
+        if (index < 1 || index > TOPICS || getConfig("Topic" + String(index)).length() == 0)
+        {
+            fail(ExpressLink::Error::InvalidTopic, "INVALID TOPIC");
+        }
+        else if (subscribe && !online)
+        {
+            fail(ExpressLink::Error::NotConnected, "NOT CONNECTED");
+        }
+        else
+        {
+            topics[index].subscribed = subscribe;
+            ok();
+            if (subscribe)
+            {
+                pushEvent(ExpressLink::SUBACK, index, "SUBACK");
+            }
+        }
+    }
+    else if (c == "EVENT?")
+    {
+        if (eventCount == 0)
+        {
+            ok();
+            return;
+        }
+        ok(events[eventHead]);
+        events[eventHead] = "";
+        eventHead = (eventHead + 1) % EVENTS;
+        eventCount--;
+    }
+    else if (c.startsWith("SHADOW"))
+    {
+        pos = 6;
+        int index = parseIndex(c, pos);
+        executeShadow(index < 0 ? 0 : index, c.substring(pos < c.length() ? pos + 1 : pos));
+    }
+    else if (c.startsWith("OTA"))
+    {
+        executeOTA(c.substring(3));
+    }
+    else if (c == "RESET" || c == "FACTORY_RESET")
+    {
+        if (c == "FACTORY_RESET")
+        {
+            for (uint8_t i = READ_ONLY_KEYS; i < KEYS; i++)
+            {
+                values[i] = "";
+            }
+        }
+        online = false;
+        for (Topic &topic : topics)
+        {
+            topic.subscribed = false;
+            topic.count = 0;
+        }
+        ok();
+        pushEvent(ExpressLink::STARTUP, 0, "STARTUP");
+    }
+    else if (c.startsWith("SLEEP"))
+    {
+        ok();
+    }
+    else
+    {
+        fail(ExpressLink::Error::UnknownCommand, "UNKNOWN COMMAND");
+    }
+}
+
+/// @brief Executes `CONF? {key}` or `CONF {key}={value}`.
+void ExpressLinkSimulator::executeConf(const String &arguments)
+{
+    bool query = arguments.startsWith("? ");
+    if (!query && !arguments.startsWith(" "))
+    {
+        fail(ExpressLink::Error::ParseError, "PARSE ERROR");
+        return;
+    }
+    String key = arguments.substring(query ? 2 : 1);
+    bool pem = query && key.endsWith(" pem");
+    if (pem)
+    {
+        key.remove(key.length() - 4);
+    }
+    int separator = key.indexOf('=');
+    if (!query && separator < 0)
+    {
+        fail(ExpressLink::Error::InvalidParameter, "INVALID PARAMETER");
+        return;
+    }
+    String value = query ? String() : key.substring(separator + 1);
+    if (!query)
+    {
+        key.remove(separator);
+    }
+
+    int i = findKey(key);
+    if (i < 0)
+    {
+        fail(ExpressLink::Error::InvalidKeyName, "INVALID KEY NAME");
+    }
+    else if (query ? key == "Passphrase" : i < READ_ONLY_KEYS)
+    {
+        fail(ExpressLink::Error::NotAllowed, "NOT ALLOWED");
+    }
+    else if (pem)
+    {
+        respondLines(values[i]);
+    }
+    else if (query)
+    {
+        ok(values[i]);
+    }
+    else
+    {
+        values[i] = value;
+        ok();
+    }
+}
+
+/// @brief Executes `SEND{index} {message}`, delivering the message to every subscribed index with the same topic name.
+void ExpressLinkSimulator::executeSend(uint8_t index, const String &message)
+{
+    String name = (index >= 1 && index <= TOPICS) ? getConfig("Topic" + String(index)) : String();
+    if (name.length() == 0)
+    {
+        fail(ExpressLink::Error::InvalidTopic, "INVALID TOPIC");
+        return;
+    }
+    if (!online)
+    {
+        fail(ExpressLink::Error::NotConnected, "NOT CONNECTED");
+        return;
+    }
+    ok();
+
+    for (uint8_t i = 1; i <= TOPICS; i++)
+    {
+        Topic &topic = topics[i];
+        if (!topic.subscribed || getConfig("Topic" + String(i)) != name)
+        {
+            continue;
+        }
+        if (topic.count == QUEUE)
+        {
+            pushEvent(ExpressLink::OVERRUN, 0, "OVERRUN", name);
+            continue;
+        }
+        topic.messages[(topic.head + topic.count) % QUEUE] = message;
+        topic.count++;
+        pushEvent(ExpressLink::MSG, i, "MSG");
+    }
+}
+
+/// @brief Executes `GET{index}`, or `GET` and `GET0` with the topic name in front of the message if `index` is -1 or 0.
+void ExpressLinkSimulator::executeGet(int index)
+{
+    if (index > TOPICS)
+    {
+        fail(ExpressLink::Error::InvalidTopic, "INVALID TOPIC");
+        return;
+    }
+    for (uint8_t i = (index > 0 ? index : 1); i <= (index > 0 ? index : TOPICS); i++)
+    {
+        Topic &topic = topics[i];
+        if (topic.count == 0)
+        {
+            continue;
+        }
+        String message = topic.messages[topic.head];
+        topic.messages[topic.head] = "";
+        topic.head = (topic.head + 1) % QUEUE;
+        topic.count--;
+        if (index > 0)
+        {
+            ok(message);
+        }
+        else
+        {
+            respond("OK1 " + getConfig("Topic" + String(i)) + "\r\n" + message + "\r\n");
+        }
+        return;
+    }
+    ok();
+}
+
+/// @brief Executes `SHADOW{index} {arguments}`.
+void ExpressLinkSimulator::executeShadow(uint8_t index, const String &arguments)
+{
+    if (index >= SHADOWS)
+    {
+        fail(ExpressLink::Error::InvalidParameter, "INVALID PARAMETER");
+        return;
+    }
+    Shadow &shadow = shadows[index];
+    if (!online && !arguments.startsWith("GET") && arguments != "INIT")
+    {
+        fail(ExpressLink::Error::NotConnected, "NOT CONNECTED");
+        return;
+    }
+
+    if (arguments == "INIT")
+    {
+        ok();
+        pushEvent(ExpressLink::SHADOW_INIT, index, "SHADOW_INIT");
+    }
+    else if (arguments == "DOC")
+    {
+        ok();
+        pushEvent(ExpressLink::SHADOW_DOC, index, "SHADOW_DOC");
+    }
+    else if (arguments == "GET DOC")
+    {
+        ok(shadow.document.length() ? "1 " + shadow.document : String("0"));
+    }
+    else if (arguments.startsWith("UPDATE "))
+    {
+        shadow.document = arguments.substring(7);
+        shadow.update = shadow.document;
+        ok();
+        pushEvent(ExpressLink::SHADOW_UPDATE, index, "SHADOW_UPDATE");
+    }
+    else if (arguments == "GET UPDATE")
+    {
+        ok(shadow.update.length() ? "1 " + shadow.update : String("0"));
+        shadow.update = "";
+    }
+    else if (arguments == "SUBSCRIBE" || arguments == "UNSUBSCRIBE")
+    {
+        shadow.subscribed = arguments == "SUBSCRIBE";
+        ok();
+        if (shadow.subscribed)
+        {
+            pushEvent(ExpressLink::SHADOW_SUBACK, index, "SHADOW_SUBACK");
+        }
+    }
+    else if (arguments == "GET DELTA")
+    {
+        ok(shadow.delta.length() ? "1 " + shadow.delta : String("0"));
+        shadow.delta = "";
+    }
+    else if (arguments == "DELETE")
+    {
+        shadow.document = "";
+        ok();
+        pushEvent(ExpressLink::SHADOW_DELETE, index, "SHADOW_DELETE");
+    }
+    else if (arguments == "GET DELETE")
+    {
+        ok("1 accepted");
+    }
+    else
+    {
+        fail(ExpressLink::Error::InvalidParameter, "INVALID PARAMETER");
+    }
+}
+
+/// @brief Executes `OTA?` and the `OTA {command}` commands for the host image.
+void ExpressLinkSimulator::executeOTA(const String &arguments)
+{
+    if (arguments == "?")
+    {
+        String state(otaState);
+        if (otaState == ExpressLink::HostUpdateProposed)
+        {
+            state += " host image";
+        }
+        else if (otaState == ExpressLink::NewHostImageReady)
+        {
+            state += " " + String((unsigned long)imageSize);
+        }
+        ok(state);
+    }
+    else if (arguments == " ACCEPT")
+    {
+        if (otaState != ExpressLink::HostUpdateProposed)
+        {
+            fail(ExpressLink::Error::InvalidOTAUpdate, "INVALID OTA UPDATE");
+            return;
+        }
+        otaState = ExpressLink::NewHostImageReady;
+        imageOffset = 0;
+        ok();
+    }
+    else if (arguments.startsWith(" READ "))
+    {
+        if (otaState != ExpressLink::NewHostImageReady)
+        {
+            fail(ExpressLink::Error::InvalidOTAUpdate, "INVALID OTA UPDATE");
+            return;
+        }
+        size_t count = arguments.substring(6).toInt();
+        if (count > imageSize - imageOffset)
+        {
+            count = imageSize - imageOffset;
+        }
+        char hex[8];
+        snprintf(hex, sizeof(hex), "%X", (unsigned)count);
+        String chunk = hex;
+        if (count > 0)
+        {
+            chunk += ' ';
+            uint16_t sum = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                uint8_t b = image[imageOffset + i];
+                snprintf(hex, sizeof(hex), "%02X", b);
+                chunk += hex;
+                sum += b;
+            }
+            snprintf(hex, sizeof(hex), " %04X", sum);
+            chunk += hex;
+        }
+        imageOffset += count;
+        ok(chunk);
+    }
+    else if (arguments.startsWith(" SEEK"))
+    {
+        size_t address = arguments.length() > 6 ? arguments.substring(6).toInt() : 0;
+        imageOffset = address < imageSize ? address : imageSize;
+        ok();
+    }
+    else if (arguments == " APPLY" || arguments == " CLOSE" || arguments == " FLUSH")
+    {
+        otaState = ExpressLink::NoOTAInProgress;
+        imageSize = 0;
+        ok();
+    }
+    else
+    {
+        fail(ExpressLink::Error::InvalidParameter, "INVALID PARAMETER");
+    }
+}
+
+/// @brief Queues response lines, readable after the command has been received and processed.
+void ExpressLinkSimulator::respond(const String &lines)
+{
+    if (outputPos == output.length())
+    {
+        output = "";
+        outputPos = 0;
+        segmentCount = 0;
+    }
+    unsigned long now = micros();
+    unsigned long start = ((long)(inputDone - now) > 0 ? inputDone : now) + latency;
+    if ((long)(outputDone - start) > 0)
+    {
+        start = outputDone;
+    }
+
+    size_t begin = output.length();
+    output += lines;
+    sent += lines.length();
+    outputDone = start + lines.length() * byteTime;
+    if (segmentCount == SEGMENTS)
+    {
+        segments[(segmentHead + segmentCount - 1) % SEGMENTS].end = output.length(); // extends the last response
+        return;
+    }
+    segments[(segmentHead + segmentCount) % SEGMENTS] = {begin, output.length(), start};
+    segmentCount++;
+}
+
+void ExpressLinkSimulator::ok(const String &result)
+{
+    respond(result.length() ? "OK " + result + "\r\n" : String("OK\r\n"));
+}
+
+/// @brief Responds with `OK{n} {first line}` and `n` additional lines, splitting the escaped `value` at each `\\A`.
+void ExpressLinkSimulator::respondLines(const String &value)
+{
+    String first;
+    String rest;
+    uint16_t additional = 0;
+    int start = 0;
+    while (start < (int)value.length())
+    {
+        int end = value.indexOf("\\A", start);
+        String line = value.substring(start, end < 0 ? value.length() : end);
+        if (start == 0)
+        {
+            first = line;
+        }
+        else
+        {
+            rest += line + "\r\n";
+            additional++;
+        }
+        start = end < 0 ? value.length() : end + 2;
+    }
+    respond("OK" + String(additional) + " " + first + "\r\n" + rest);
+}
+
+void ExpressLinkSimulator::fail(ExpressLink::Error::Code code, const char *mnemonic)
+{
+    respond("ERR" + String((int)code) + " " + mnemonic + "\r\n");
+}
+
+int ExpressLinkSimulator::findKey(const String &key) const
+{
+    for (uint8_t i = 0; i < KEYS; i++)
+    {
+        if (keys[i].length() > 0 && keys[i] == key)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
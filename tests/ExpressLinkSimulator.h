@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ExpressLink.h>
+
+/// @brief Emulates an ExpressLink module behind a `Stream`, for host builds without hardware.
+///
+/// Commands written by the host are executed when their line is complete, and the response becomes readable after
+/// the configured latency, at the configured baud rate. The simulator keeps a configuration dictionary, the
+/// connection state, per-topic message queues fed by an in-process MQTT loopback (a `SEND` is delivered to every
+/// subscribed topic index with the same topic name), an event queue, shadow documents and a host OTA image.
+/// Payloads are stored and returned in their escaped wire form.
+class ExpressLinkSimulator : public Stream
+{
+public:
+    static const uint8_t TOPICS = 16;   /// `Topic1` to `Topic16`
+    static const uint8_t QUEUE = 8;     /// messages per topic before an `OVERRUN` event
+    static const uint8_t EVENTS = 16;   /// pending events, older events are lost
+    static const uint8_t SHADOWS = 4;   /// shadow index 0 is the unnamed shadow
+    static const uint8_t SEGMENTS = 16; /// responses in flight
+
+    ExpressLinkSimulator();
+
+    void setLatency(uint32_t latency);
+    void setBaudRate(uint32_t baud);
+    void setReceiveBuffer(size_t size);
+    void setHostImage(const uint8_t *image, size_t size);
+    void setShadowDelta(uint8_t index, const String &delta);
+    void dropConnection();
+    void pushEvent(ExpressLink::EventCode code, int parameter, const char *mnemonic, const String &detail = "");
+
+    String getConfig(const String &key) const;
+    bool setConfig(const String &key, const String &value);
+
+    /// @return true while connected to the simulated broker
+    bool connected() const { return online; }
+    /// @return number of commands executed
+    uint32_t commands() const { return executed; }
+    /// @return number of bytes written by the host
+    uint32_t bytesReceived() const { return received; }
+    /// @return number of response bytes queued for the host
+    uint32_t bytesSent() const { return sent; }
+    /// @return number of response bytes lost because the host did not read them in time, see `setReceiveBuffer()`
+    uint32_t bytesDropped() const { return dropped; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    using Print::write;
+
+private:
+    void execute(const String &command);
+    void executeConf(const String &arguments);
+    void executeSend(uint8_t index, const String &message);
+    void executeGet(int index);
+    void executeShadow(uint8_t index, const String &arguments);
+    void executeOTA(const String &arguments);
+    void respond(const String &lines);
+    void ok(const String &result = "");
+    void respondLines(const String &value);
+    void fail(ExpressLink::Error::Code code, const char *mnemonic);
+    int findKey(const String &key) const;
+
+    struct Segment
+    {
+        size_t begin;        /// offset of the first byte in `output`
+        size_t end;          /// offset after the last byte in `output`
+        unsigned long start; /// `micros()` when the first byte becomes readable
+    };
+
+    struct Topic
+    {
+        bool subscribed;
+        String messages[QUEUE];
+        uint8_t head;
+        uint8_t count;
+    };
+
+    struct Shadow
+    {
+        String document;
+        String update;
+        String delta;
+        bool subscribed;
+    };
+
+    static const uint8_t KEYS = 40;
+    String keys[KEYS];
+    String values[KEYS];
+
+    Topic topics[TOPICS + 1]; // index 0 is unused
+    String events[EVENTS];
+    uint8_t eventHead = 0;
+    uint8_t eventCount = 0;
+    Shadow shadows[SHADOWS];
+
+    uint8_t image[1024];
+    size_t imageSize = 0;
+    size_t imageOffset = 0;
+    int otaState = ExpressLink::NoOTAInProgress;
+
+    bool online = false;
+
+    String input;
+    String output;
+    size_t outputPos = 0;
+    Segment segments[SEGMENTS];
+    uint8_t segmentHead = 0;
+    uint8_t segmentCount = 0;
+    unsigned long inputDone = 0;
+    unsigned long outputDone = 0;
+
+    uint32_t latency = 0;  // microseconds
+    uint32_t byteTime = 0; // microseconds per byte, 0 for no baud rate limit
+    size_t receiveBuffer = 0; // bytes the host can buffer before it reads them, 0 for no limit
+
+    uint32_t executed = 0;
+    uint32_t received = 0;
+    uint32_t sent = 0;
+    uint32_t dropped = 0;
+};
@@ -0,0 +1,2 @@
+// counts heap allocations, shared with the benchmarks
+#include "../../benchmarks/allocations.cpp"
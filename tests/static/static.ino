@@ -0,0 +1,197 @@
+#line 2 "static.ino"
+
+#include <AUnit.h>
+
+#include <ExpressLink.h>
+#include <ExpressLinkShadow.h>
+
+#include "../../benchmarks/allocations.h"
+
+#if !EXPRESSLINK_STATIC
+#error "build with -DEXPRESSLINK_STATIC=1, see Makefile"
+#endif
+
+using namespace aunit;
+
+void setup() {
+  Serial.begin(115200); // Serial in tests here is stdin/stdout, so baud rate doesn't matter!
+}
+
+void loop() {
+  aunit::TestRunner::run();
+}
+
+/// @brief Expects the commands in `command` and replies with `response`, without any heap allocations.
+class ScriptStream: public Stream {
+  public:
+    ScriptStream(const char *c, const char *r) : command(c), response(r) {}
+
+    size_t write(uint8_t c) {
+      if (c == (uint8_t)command[command_index]) {
+        command_index++;
+        return 1;
+      }
+
+      Serial.printf("ERROR: write mismatch! Expected '0x%x' but got '0x%x' at position %d\n", command[command_index], c, command_index);
+      exit(1);
+    }
+
+    int available() {
+      return response[response_index] != '\0';
+    }
+
+    int read() {
+      int c = peek();
+      response_index += (c >= 0);
+      return c;
+    }
+
+    int peek() {
+      return available() ? (uint8_t)response[response_index] : -1;
+    }
+
+    bool valid() {
+      return command[command_index] == '\0' && response[response_index] == '\0';
+    }
+
+    const char *command;
+    uint32_t command_index = 0;
+
+    const char *response;
+    uint32_t response_index = 0;
+};
+
+test(noAllocations) {
+  if (!allocationsTracked()) {
+    skipTestNow();
+  }
+  ScriptStream s(
+      "AT\n"
+      "AT+CONF? About\n"
+      "AT+CONF? ThingName\n"
+      "AT+CONF CustomName=sensor\n"
+      "AT+CONF Topic1=sensors\n"
+      "AT+SUBSCRIBE1\n"
+      "AT+SEND1 {\"t\":21.5}\n"
+      "AT+CONF? Passphrase\n"
+      "AT+EVENT?\n"
+      "AT+OTA?\n"
+      "AT+CONF? RootCA pem\n",
+
+      "OK\r\n"
+      "OK ExpressLink v1\r\n"
+      "OK thing\r\n"
+      "OK\r\n"
+      "OK\r\n"
+      "OK\r\n"
+      "OK\r\n"
+      "ERR10 NOT ALLOWED the passphrase cannot be read, this detail is longer than the error buffer\r\n"
+      "OK 4 0 OVERRUN sensors\r\n"
+      "OK 1 v2.0\r\n"
+      "OK2 -----BEGIN CERTIFICATE-----\r\n"
+      "AAECAw==\r\n"
+      "-----END CERTIFICATE-----\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  resetAllocations();
+
+  assertTrue(el.cmd("CONF? About"));
+  assertEqual(el.response.c_str(), "ExpressLink v1");
+
+  el.config.enableCache();
+  assertEqual(el.config.getThingName().c_str(), "thing");
+  assertEqual(el.config.getThingName().c_str(), "thing"); // from the cache
+  assertTrue(el.config.setCustomName("sensor"));
+  assertTrue(el.subscribe(1, "sensors"));
+  assertTrue(el.publish(1, "{\"t\":21.5}"));
+
+  assertFalse(el.config.get("Passphrase"));
+  assertEqual(el.lastError().code, ExpressLink::Error::NotAllowed);
+  assertTrue(el.error.truncated());
+  assertEqual(el.error.length(), (size_t)EXPRESSLINK_MAX_ERROR - 1);
+
+  ExpressLink::Event event = el.getEvent(false);
+  assertEqual(event.code, ExpressLink::OVERRUN);
+  assertEqual(el.response.c_str(), " OVERRUN sensors");
+
+  ExpressLink::OTAState ota = el.otaGetState();
+  assertEqual(ota.code, ExpressLink::UpdateProposed);
+  assertEqual(ota.detail.c_str(), "v2.0");
+
+  assertTrue(el.config.getRootCA().length() > 0);
+
+  assertTrue(s.valid());
+  assertEqual(allocations().count, (uint32_t)0);
+}
+
+test(fixedCapacity) {
+  ExpressLinkString<8> value("1234567890");
+  assertEqual(value.c_str(), "1234567");
+  assertTrue(value.truncated());
+
+  value = "  a\\Ab ";
+  value.trim();
+  assertEqual(value.c_str(), "a\\Ab");
+  assertFalse(value.truncated());
+  assertEqual(value.indexOf('\\'), 1);
+
+  value = value.c_str() + 2; // assigning a part of itself
+  assertEqual(value.c_str(), "Ab");
+  assertFalse(value.reserve(8));
+
+  value[2] = 'x'; // out of range, must not overwrite the null-terminator
+  assertEqual(value.c_str(), "Ab");
+  assertEqual(value.length(), (size_t)2);
+}
+
+class EscapingExpressLink : public ExpressLink {
+  public:
+    using ExpressLink::escape;
+};
+
+test(escapeOverflow) {
+  EscapingExpressLink el;
+  ExpressLinkText value;
+  while (value.length() < ExpressLinkText::capacity()) {
+    value += '\n';
+  }
+  assertFalse(el.escape(value));
+  assertEqual(value.length(), ExpressLinkText::capacity());
+  assertEqual(value.charAt(0), '\n');
+
+  value = "a\nb";
+  assertTrue(el.escape(value));
+  assertEqual(value.c_str(), "a\\Ab");
+}
+
+test(shadowMirror) {
+  if (!allocationsTracked()) {
+    skipTestNow();
+  }
+  ScriptStream s(
+      "AT\n"
+      "AT+SHADOW UPDATE {\"state\":{\"reported\":{\"t\":21.50,\"name\":\"a\\\\\"b\"}}}\n", // the backslash is escaped on the wire
+
+      "OK\r\n"
+      "OK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  resetAllocations();
+
+  ExpressLinkShadow shadow(el);
+  assertTrue(shadow.reportFloat("t", 21.5));
+  assertTrue(shadow.reportString("name", "a\"b"));
+  assertFalse(shadow.reportString("long", "a value longer than EXPRESSLINK_SHADOW_VALUE"));
+  assertEqual(shadow.statistics().overflows, 1u);
+  assertTrue(shadow.update());
+  assertEqual(shadow.reported("t"), "21.50");
+
+  assertEqual(shadow.mergeDelta("{\"state\":{\"led\":\"on\",\"text\":\"a desired value that does not fit\"}}"), 1);
+  assertEqual(shadow.desired("led"), "\"on\"");
+  assertEqual(shadow.statistics().overflows, 2u);
+
+  assertTrue(s.valid());
+  assertEqual(allocations().count, (uint32_t)0);
+}
@@ -4,6 +4,14 @@
 
 #include <Wire.h>
 #include <ExpressLink.h>
+#include <ExpressLinkBatch.h>
+#include <ExpressLinkCBOR.h>
+#include <ExpressLinkJSON.h>
+#include <ExpressLinkPacer.h>
+#include <ExpressLinkShadow.h>
+#include <ExpressLinkSpool.h>
+
+#include "ExpressLinkSimulator.h"
 
 using namespace aunit;
 
@@ -140,3 +148,1071 @@ test(otaState) {
 
   assertTrue(s.valid());
 }
+
+test(publishBuffer) {
+  MockStream s("AT\nAT+SEND1 {\"a\":\"x\\\\y\\Az\"}\n", "OK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  const char message[] = "{\"a\":\"x\\y\nz\"}";
+  assertTrue(el.publish(1, message, strlen(message)));
+  assertEqual(el.error, "");
+
+  assertTrue(s.valid());
+}
+
+test(unnamedShadowUpdate) {
+  MockStream s("AT\nAT+SHADOW UPDATE {}\nAT+SHADOW2 UPDATE {}\n", "OK\r\nOK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  assertTrue(el.shadowUpdate("{}"));
+  assertTrue(el.shadowUpdate("{}", 2, 2));
+
+  assertTrue(s.valid());
+}
+
+test(longCommand) {
+  String message;
+  for (int i = 0; i < 2 * EXPRESSLINK_MAX_LINE; i++) {
+    message += (char)('a' + i % 26);
+  }
+  MockStream s("AT\nAT+SEND1 " + message + "\n", "OK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  assertTrue(el.publish(1, message.c_str(), message.length()));
+
+  assertTrue(s.valid());
+}
+
+class EscapingExpressLink : public ExpressLink {
+  public:
+    using ExpressLink::escape;
+    using ExpressLink::unescape;
+};
+
+test(escapeRoundTrip) {
+  EscapingExpressLink el;
+  String value = "a\nb\r\\c\\A";
+  assertTrue(el.escape(value));
+  assertEqual(value, "a\\Ab\\D\\\\c\\\\A");
+  el.unescape(value);
+  assertEqual(value, "a\nb\r\\c\\A");
+}
+
+test(asyncCommands) {
+  MockStream s("AT\nAT+SEND1 a\nAT+SEND2 b\nAT+CONNECT?\n", "OK\r\nOK\r\nERR7 OVERFLOW\r\nOK 1 0 CONNECTED CUSTOMER\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+
+  int completed = 0;
+  auto callback = [](ExpressLink &, ExpressLink::Command &command) { (*(int *)command.context)++; };
+  ExpressLink::Command first, second;
+  assertTrue(el.publishAsync(first, 1, "a", 1, callback, &completed));
+  assertTrue(el.publishAsync(second, 2, "b", 1, callback, &completed));
+  assertFalse(el.publishAsync(second, 2, "b", 1));
+  assertTrue(first.pending());
+
+  // blocking commands wait for queued ones to complete first
+  assertTrue(el.isConnected());
+  assertEqual(completed, 2);
+  assertEqual(first.status, ExpressLink::Command::Succeeded);
+  assertEqual(second.status, ExpressLink::Command::Failed);
+  assertFalse(el.poll());
+
+  assertTrue(s.valid());
+}
+
+test(largeResponse) {
+  // the longest value that fits into the line buffer after `OK `
+  String value;
+  for (int i = 0; i < EXPRESSLINK_MAX_LINE - 4; i++) {
+    value += (char)('a' + i % 26);
+  }
+  MockStream s("AT\nAT+CONF? ShadowToken\n", "OK\r\nOK " + value + "\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  assertEqual(el.config.getShadowToken(), value);
+
+  assertTrue(s.valid());
+}
+
+test(commandTimeout) {
+  MockStream s("AT\nAT+CONF? About\n", "OK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  unsigned long start = millis();
+  assertFalse(el.cmd("CONF? About", 11, 50));
+  assertLess(millis() - start, 1000ul);
+  assertEqual(el.error, "");
+
+  assertTrue(s.valid());
+}
+
+test(publishStream) {
+  MockStream s("AT\nAT+SEND2 line1\\Aline2\n", "OK\r\nOK\r\n");
+  MockStream file("", "line1\nline2");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  assertTrue(el.publish(2, file));
+
+  assertTrue(s.valid());
+  assertTrue(file.valid());
+}
+
+test(publishProducer) {
+  MockStream s("AT\nAT+SEND3 [0,1,2,3,4,5,6,7,8,9]\n", "OK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  int next = 0;
+  auto producer = [](uint8_t *buffer, size_t size, void *context) -> size_t {
+    int &i = *(int *)context;
+    if (i > 10) {
+      return 0;
+    }
+    int n = snprintf((char *)buffer, size, i == 0 ? "[%d" : (i < 10 ? ",%d" : "]"), i);
+    i++;
+    return n;
+  };
+  assertTrue(el.publish(3, producer, &next));
+
+  assertTrue(s.valid());
+}
+
+struct OTAImage {
+  uint8_t data[16];
+  size_t size = 0;
+};
+
+test(otaDownload) {
+  MockStream s("AT\nAT+OTA READ 4\nAT+OTA READ 4\nAT+OTA SEEK 4\nAT+OTA READ 4\nAT+OTA READ 4\nAT+OTA READ 4\n",
+               "OK\r\nOK 4 DEADBEEF\r\nOK 4 0102030400FF\r\nOK\r\nOK 4 01020304 000A\r\nOK 2 0506\r\nOK 0\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  OTAImage image;
+  auto sink = [](uint32_t offset, const uint8_t *data, size_t length, void *context) {
+    OTAImage &image = *(OTAImage *)context;
+    if (offset != image.size || image.size + length > sizeof(image.data)) {
+      return false;
+    }
+    memcpy(image.data + offset, data, length);
+    image.size += length;
+    return true;
+  };
+  auto download = el.otaDownload(sink, &image, 4);
+  assertTrue(download.success);
+  assertEqual(download.size, 10u);
+  assertEqual(download.retries, 1);
+  assertEqual(download.checksum, 0xDE + 0xAD + 0xBE + 0xEF + 1 + 2 + 3 + 4 + 5 + 6);
+  assertEqual(image.size, 10u);
+  assertEqual(image.data[0], 0xDE);
+  assertEqual(image.data[9], 0x06);
+
+  assertTrue(s.valid());
+}
+
+struct SlowFlash {
+  uint8_t data[1000];
+  size_t size = 0;
+};
+
+test(otaPipelined) {
+  ExpressLinkSimulator sim;
+  sim.setBaudRate(ExpressLink::BAUDRATE);
+  sim.setReceiveBuffer(EXPRESSLINK_UART_BUFFER);
+
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  uint8_t image[1000];
+  for (size_t i = 0; i < sizeof(image); i++) {
+    image[i] = i * 7;
+  }
+  sim.setHostImage(image, sizeof(image));
+  assertTrue(el.otaAccept());
+
+  // the next response arrives completely while the sink writes to flash, it must fit into the UART buffer
+  SlowFlash flash;
+  auto download = el.otaDownload([](uint32_t offset, const uint8_t *data, size_t length, void *context) {
+    SlowFlash &flash = *(SlowFlash *)context;
+    memcpy(flash.data + offset, data, length);
+    flash.size += length;
+    delay(30);
+    return true;
+  }, &flash, 0, 0, true);
+  assertTrue(download.success);
+  assertEqual(download.retries, 0);
+  assertEqual(sim.bytesDropped(), 0u);
+  assertEqual(flash.size, sizeof(image));
+  assertEqual(memcmp(flash.data, image, sizeof(image)), 0);
+}
+
+struct EventLog {
+  int messages = 0;
+  int other = 0;
+  String detail;
+};
+
+test(processEvents) {
+  MockStream s("AT\nAT+EVENT?\nAT+EVENT?\nAT+EVENT?\nAT+EVENT?\n",
+               "OK\r\nOK 1 2 MSG\r\nOK 4 0 OVERRUN sensors/alarm\r\nOK 1 1 MSG\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  EventLog log;
+  el.onEvent(ExpressLink::MSG, [](ExpressLink &, const ExpressLink::Event &event, const char *, void *context) {
+    ((EventLog *)context)->messages += event.parameter;
+  }, &log);
+  el.onEvent(ExpressLink::UNKNOWN, [](ExpressLink &, const ExpressLink::Event &, const char *detail, void *context) {
+    ((EventLog *)context)->other++;
+    ((EventLog *)context)->detail = detail;
+  }, &log);
+
+  assertEqual(el.processEvents(), 3);
+  assertEqual(log.messages, 3);
+  assertEqual(log.other, 1);
+  assertEqual(log.detail, "sensors/alarm");
+
+  assertTrue(s.valid());
+}
+
+test(eventPin) {
+  MockStream s("AT\n", "OK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s, 7));
+  assertFalse(el.eventPending());
+  assertEqual(el.getEvent().code, ExpressLink::NONE);
+  assertEqual(el.processEvents(), 0);
+
+  assertTrue(s.valid());
+}
+
+test(receiveMessage) {
+  MockStream s("AT\nAT+GET2\nAT+GET\nAT+GET3\n", "OK\r\nOK hello\r\nOK1 a/b\r\n{\"x\":1}\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  char buffer[16];
+  ExpressLink::Message message;
+  assertTrue(el.receive(2, message, buffer, sizeof(buffer)));
+  assertEqual(message.payload, "hello");
+  assertEqual(message.topic, "");
+  assertFalse(message.truncated);
+
+  assertTrue(el.receive(-1, message, buffer, sizeof(buffer)));
+  assertEqual(message.topic, "a/b");
+  assertEqual(message.payload, "{\"x\":1}");
+  assertEqual(message.length, 7u);
+
+  assertFalse(el.receive(3, message, buffer, sizeof(buffer)));
+  assertEqual(el.error, "");
+
+  assertTrue(s.valid());
+}
+
+test(drainMessages) {
+  MockStream s("AT\nAT+GET1\nAT+GET1\nAT+GET1\n", "OK\r\nOK first message\r\nOK second\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  char buffer[8];
+  int truncated = 0;
+  auto handler = [](ExpressLink &, const ExpressLink::Message &message, void *context) {
+    *(int *)context += message.truncated;
+  };
+  assertEqual(el.drain(1, buffer, sizeof(buffer), handler, &truncated), 2);
+  assertEqual(truncated, 1);
+
+  assertTrue(s.valid());
+}
+
+test(publishBatch) {
+  MockStream s("AT\nAT+SEND1 [{\"t\":1},{\"t\":2},{\"t\":3}]\nAT+SEND1 [{\"t\":4}]\n", "OK\r\nOK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  char buffer[64];
+  ExpressLinkBatch batch(el, 1, buffer, sizeof(buffer));
+  batch.setPolicy(0, 3);
+  assertTrue(batch.add("{\"t\":1}"));
+  assertTrue(batch.add("{\"t\":2}"));
+  assertEqual(batch.pending(), 2);
+  assertTrue(batch.add("{\"t\":3}"));
+  assertEqual(batch.pending(), 0);
+  assertTrue(batch.add("{\"t\":4}"));
+  assertTrue(batch.flush());
+
+  assertEqual(batch.statistics().samples, 4u);
+  assertEqual(batch.statistics().messages, 2u);
+  assertEqual(batch.statistics().coalesced, 2u);
+  assertTrue(s.valid());
+}
+
+test(oversizedBatchSample) {
+  MockStream s("AT\nAT+SEND1 [1]\nAT+SEND1 [{\"t\":123}]\nAT+SEND2 {\"t\":123}\n", "OK\r\nOK\r\nOK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  char buffer[16];
+  ExpressLinkBatch batch(el, 1, buffer, sizeof(buffer));
+  batch.setPolicy(8);
+  assertTrue(batch.add("1"));
+  // exceeds the size limit, published on its own but still as an array
+  assertTrue(batch.add("{\"t\":123}"));
+  assertEqual(batch.statistics().messages, 2u);
+  // does not fit into the buffer with the brackets
+  assertFalse(batch.add("{\"temperature\":21}"));
+  assertEqual(batch.statistics().dropped, 1u);
+  assertEqual(batch.statistics().messages, 2u);
+
+  char lines[16];
+  ExpressLinkBatch text(el, 2, lines, sizeof(lines), ExpressLinkBatch::Lines);
+  text.setPolicy(8);
+  assertTrue(text.add("{\"t\":123}"));
+
+  assertTrue(s.valid());
+}
+
+test(configCache) {
+  MockStream s("AT\nAT+CONF? Endpoint\nAT+CONF Topic1=a/b\nAT+SUBSCRIBE1\nAT+RESET\nAT+CONF? Endpoint\n",
+               "OK\r\nOK example.com\r\nOK\r\nOK\r\nOK\r\nOK other.com\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  el.config.enableCache();
+  assertEqual(el.config.getEndpoint(), "example.com");
+  assertEqual(el.config.getEndpoint(), "example.com");
+  assertTrue(el.config.setEndpoint("example.com"));
+  assertTrue(el.config.setTopic(1, "a/b"));
+  assertEqual(el.config.getTopic(1), "a/b");
+  assertTrue(el.subscribe(1, "a/b"));
+  assertTrue(el.reset());
+  assertEqual(el.config.getEndpoint(), "other.com");
+
+  assertTrue(s.valid());
+}
+
+test(configCacheCommands) {
+  MockStream s("AT\nAT+CONF? Endpoint\nAT+CONF? Passphrase\nAT+CONF Endpoint=new.com\nAT+CONF? Endpoint\nAT+CONF Endpoint=async.com\nAT+CONF? Endpoint\n",
+               "OK\r\nOK example.com\r\nERR10 NOT ALLOWED\r\nOK\r\nOK new.com\r\nOK\r\nOK async.com\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  el.config.enableCache();
+  assertEqual(el.config.getEndpoint(), "example.com");
+  assertFalse(el.cmd("CONF? Passphrase"));
+  // a cache hit leaves no error of the previous command behind
+  assertEqual(el.config.getEndpoint(), "example.com");
+  assertEqual(el.lastError().code, ExpressLink::Error::None);
+  assertEqual(el.error, "");
+
+  // writes sent as raw commands invalidate the cached value
+  assertTrue(el.cmd("AT+CONF Endpoint=new.com"));
+  assertEqual(el.config.getEndpoint(), "new.com");
+  ExpressLink::Command handle;
+  assertTrue(el.cmdAsync(handle, "CONF Endpoint=async.com"));
+  while (handle.pending()) {
+    el.poll();
+  }
+  assertEqual(el.config.getEndpoint(), "async.com");
+
+  assertTrue(s.valid());
+}
+
+test(longKey) {
+  MockStream s("AT\n", "OK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  // nothing is sent if the command header does not fit
+  assertFalse(el.config.set("AKeyNameThatIsFarTooLongToFit", "x", 1));
+  assertEqual(el.lastError().code, ExpressLink::Error::CommandTooLong);
+  assertEqual(el.lastError().detail, "key too long");
+  assertFalse(el.config.getPEM("AKeyNameThatIsFarTooLongToFit", [](const char *, size_t, void *) {
+    return true;
+  }));
+  MockStream value("", "-----BEGIN CERTIFICATE-----");
+  assertFalse(el.config.set("AKeyNameThatIsFarTooLongToFit", value));
+  assertEqual(el.lastError().code, ExpressLink::Error::CommandTooLong);
+
+  assertTrue(s.valid());
+}
+
+test(connectionStatus) {
+  MockStream s("AT\nAT+CONNECT?\nAT+EVENT?\nAT+CONNECT\n", "OK\r\nOK 1 1 CONNECTED CUSTOMER\r\nOK 3 0 CONLOST\r\nOK 1 CONNECTED\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  assertEqual(el.lastConnectionStatus().updated, 0ul);
+  auto status = el.connectionStatus();
+  assertTrue(status.connected);
+  assertTrue(status.onboarded);
+
+  assertEqual(el.getEvent(false).code, ExpressLink::CONLOST);
+  assertFalse(el.lastConnectionStatus().connected);
+  assertTrue(el.lastConnectionStatus().onboarded);
+
+  assertTrue(el.connect());
+  assertTrue(el.lastConnectionStatus().connected);
+
+  assertTrue(s.valid());
+}
+
+test(retryPolicy) {
+  MockStream s("AT\nAT+SEND1 a\nAT+SEND1 a\nAT+SEND1 a\nAT+SUBSCRIBE2\n",
+               "OK\r\nERR3 OUT OF MEMORY\r\nERR10 NOT CONNECTED\r\nOK\r\nERR7 INVALID PARAMETER topic 2\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  ExpressLink::RetryPolicy policy;
+  policy.attempts = 3;
+  policy.delay = 1;
+  el.setRetryPolicy(policy);
+
+  assertTrue(el.publish(1, "a"));
+  assertEqual(el.lastError().code, ExpressLink::Error::None);
+
+  assertFalse(el.subscribe(2, "")); // not retried
+  auto error = el.lastError();
+  assertEqual(error.code, ExpressLink::Error::InvalidParameter);
+  assertEqual(error.number, (uint16_t)7);
+  assertEqual(error.detail, "topic 2");
+  assertEqual(error.category(), ExpressLink::Error::Permanent);
+
+  assertTrue(s.valid());
+}
+
+test(retryLateResponse) {
+  ExpressLinkSimulator sim;
+  sim.setLatency(30);
+
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  assertTrue(el.connect());
+  assertTrue(el.subscribe(1, "sensors"));
+  assertEqual(ExpressLink::RetryPolicy().retryOn, (uint8_t)ExpressLink::Error::Transient);
+
+  ExpressLink::RetryPolicy policy;
+  policy.attempts = 3;
+  policy.delay = 1000; // longer than the latency, so the late response is recognized
+  policy.jitter = 0;
+  policy.retryOn |= ExpressLink::Error::TimedOut;
+  el.setRetryPolicy(policy);
+  el.setTimeout(10);
+
+  uint32_t commands = sim.commands();
+  assertTrue(el.publish(1, "once")); // the OK arrives after the timeout, during the retry delay
+  assertEqual(sim.commands(), commands + 1);
+
+  el.setTimeout(1000);
+  char buffer[32];
+  ExpressLink::Message message;
+  assertTrue(el.receive(1, message, buffer, sizeof(buffer)));
+  assertEqual(message.payload, "once");
+  assertFalse(el.receive(1, message, buffer, sizeof(buffer))); // published only once
+  assertEqual(el.lastError().code, ExpressLink::Error::None);
+}
+
+test(lateResponseDiscarded) {
+  ExpressLinkSimulator sim;
+  sim.setLatency(30);
+
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  el.setTimeout(10);
+  assertFalse(el.cmd("CONF? ThingName")); // no retries, the response arrives after the timeout
+  assertEqual(el.lastError().code, ExpressLink::Error::Timeout);
+
+  delay(40);
+  el.setTimeout(1000);
+  assertTrue(el.cmd("CONNECT?"));
+  assertTrue(el.response.indexOf("DISCONNECTED") > 0); // not the late ThingName
+}
+
+test(offlineSpool) {
+  MockStream s("AT\nAT+CONNECT?\nAT+CONNECT\nAT+SEND1 m2\nAT+SEND2 m3\nAT+CONNECT\nAT+SEND2 m3\nAT+SEND1 m4\nAT+SEND1 m5\nAT+SEND1 m6\n",
+               "OK\r\nOK 0 0 DISCONNECTED STAGING\r\nOK 1 CONNECTED\r\nOK\r\nERR10 NOT CONNECTED\r\nOK 1 CONNECTED\r\nOK\r\nOK\r\nOK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  uint8_t buffer[20];
+  ExpressLinkSpool spool(el, buffer, sizeof(buffer));
+  spool.setPolicy(ExpressLinkSpool::OverwriteOldest, 0);
+  assertTrue(spool.publish(1, "m1"));
+  assertTrue(spool.publish(1, "m2"));
+  assertTrue(spool.publish(2, "m3"));
+  assertTrue(spool.publish(1, "m4"));
+  assertTrue(spool.publish(1, "m5")); // overwrites m1
+  assertEqual(spool.pending(), 4u);
+  assertTrue(spool.poll()); // not connected yet
+
+  assertTrue(el.connect());
+  assertTrue(spool.poll());
+  assertFalse(spool.poll());
+  assertFalse(el.lastConnectionStatus().connected); // NOT CONNECTED marks the connection as lost
+  assertTrue(spool.poll()); // nothing is sent until connected again
+
+  assertTrue(el.connect());
+  while (spool.pending() > 0) {
+    assertTrue(spool.poll());
+  }
+  assertTrue(spool.publish(1, "m6"));
+
+  assertEqual(spool.statistics().spooled, 5u);
+  assertEqual(spool.statistics().replayed, 4u);
+  assertEqual(spool.statistics().overwritten, 1u);
+  assertEqual(spool.statistics().failures, 1u);
+  assertEqual(spool.statistics().peak, 20u);
+  assertTrue(s.valid());
+}
+
+struct FlakyStorage {
+  uint8_t data[32];
+  int reads = 0;
+  int failAt = -1; /// index of the read that fails
+};
+
+test(spoolReadError) {
+  MockStream s("AT\nAT+CONNECT?\nAT+CONNECT\nAT+SEND1 \nAT+SEND1 m1\n",
+               "OK\r\nOK 0 0 DISCONNECTED STAGING\r\nOK 1 CONNECTED\r\nOK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  FlakyStorage storage;
+  ExpressLinkSpool spool(el, sizeof(storage.data), [](uint32_t offset, uint8_t *data, size_t length, void *context) {
+    FlakyStorage &storage = *(FlakyStorage *)context;
+    memcpy(data, storage.data + offset, length);
+    return storage.reads++ != storage.failAt;
+  }, [](uint32_t offset, const uint8_t *data, size_t length, void *context) {
+    memcpy(((FlakyStorage *)context)->data + offset, data, length);
+    return true;
+  }, &storage);
+  spool.setPolicy(ExpressLinkSpool::OverwriteOldest, 0);
+  assertTrue(spool.publish(1, "m1")); // spooled while disconnected
+  assertEqual(spool.pending(), 1u);
+  assertTrue(el.connect());
+
+  storage.failAt = storage.reads + 1; // the payload, after the record header
+  assertFalse(spool.poll()); // the truncated message is not counted as replayed
+  assertEqual(spool.pending(), 1u);
+  assertEqual(spool.statistics().failures, 1u);
+  assertEqual(spool.statistics().replayed, 0u);
+
+  assertTrue(spool.poll());
+  assertEqual(spool.pending(), 0u);
+  assertEqual(spool.statistics().replayed, 1u);
+  assertTrue(s.valid());
+}
+
+test(spoolConnectedAtStart) {
+  MockStream s("AT\nAT+CONNECT?\nAT+SEND1 m1\nAT+SEND1 m2\n", "OK\r\nOK 1 1 CONNECTED CUSTOMER\r\nOK\r\nOK\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  uint8_t buffer[20];
+  ExpressLinkSpool spool(el, buffer, sizeof(buffer));
+  assertTrue(spool.publish(1, "m1")); // queries the connection state once, as nothing has updated it
+  assertTrue(spool.publish(1, "m2"));
+  assertEqual(spool.pending(), 0u);
+  assertTrue(s.valid());
+}
+
+test(adaptivePacing) {
+  MockStream s("AT\nAT+SEND1 a\nAT+EVENT?\nAT+EVENT?\nAT+SEND1 b\n",
+               "OK\r\nOK\r\nOK 4 0 OVERRUN sensors\r\nOK\r\nERR3 OUT OF MEMORY\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  unsigned long time = 1000;
+  el.setClock([](void *context) { return *(unsigned long *)context; }, &time);
+  ExpressLinkPacer pacer(el, 10, 100);
+  el.onEvent(ExpressLink::OVERRUN, ExpressLinkPacer::onOverrun, &pacer);
+  uint16_t rate = 10 + (100 - 10) / 2;
+  assertEqual(pacer.rate(), rate);
+
+  assertTrue(pacer.publish(1, "a"));
+  assertEqual(el.processEvents(), 1);
+  rate = rate * 50 / 100;
+  assertEqual(pacer.rate(), rate);
+  time += 1000 / rate; // congestion signals within one publish interval count once
+  assertFalse(pacer.publish(1, "b"));
+  rate = rate * 50 / 100;
+  assertEqual(pacer.rate(), rate);
+  assertEqual(pacer.batchBytes(), (size_t)(ExpressLink::BAUDRATE / 10 / rate));
+
+  assertFalse(pacer.ready());
+  assertFalse(pacer.publish(1, "c", 1, 0)); // not due, nothing is sent
+  el.onIdle([](ExpressLink &, const ExpressLink::Command *, uint32_t, void *context) { (*(unsigned long *)context)++; }, &time);
+  unsigned long waiting = time;
+  assertFalse(pacer.publish(1, "c", 1, 5)); // the idle hook runs while waiting, here it advances the clock
+  assertEqual(time - waiting, 5ul);
+  el.onIdle(nullptr);
+
+  assertEqual(pacer.statistics().sent, 2u);
+  assertEqual(pacer.statistics().overruns, 1u);
+  assertEqual(pacer.statistics().errors, 1u);
+  assertEqual(pacer.statistics().decreases, 2u);
+  assertTrue(s.valid());
+}
+
+test(simulator) {
+  ExpressLinkSimulator sim;
+  sim.setLatency(1);
+  sim.setBaudRate(ExpressLink::BAUDRATE);
+
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  assertTrue(el.config.setEndpoint("example.com"));
+  assertEqual(el.config.getEndpoint(), "example.com");
+  assertFalse(el.publish(1, "{}"));
+  assertEqual(el.lastError().code, ExpressLink::Error::InvalidTopic);
+
+  assertTrue(el.connect());
+  assertTrue(el.connectionStatus().onboarded);
+  assertTrue(el.subscribe(1, "sensors"));
+  assertTrue(el.config.setTopic(2, "sensors"));
+  assertTrue(el.publish(2, "line1\nline2"));
+
+  char buffer[64];
+  ExpressLink::Message message;
+  assertTrue(el.receive(-1, message, buffer, sizeof(buffer)));
+  assertEqual(message.topic, "sensors");
+  assertEqual(message.payload, "line1\nline2");
+  assertEqual(el.getEvent(false).code, ExpressLink::SUBACK);
+  assertEqual(el.getEvent(false).code, ExpressLink::MSG);
+
+  assertTrue(el.shadowUpdate("{\"state\":{}}"));
+  assertTrue(el.shadowGetUpdate());
+  assertEqual(el.response, "1 {\"state\":{}}");
+
+  const uint8_t image[] = {1, 2, 3, 4, 5};
+  sim.setHostImage(image, sizeof(image));
+  assertTrue(el.otaAccept());
+  OTAImage received;
+  auto download = el.otaDownload([](uint32_t offset, const uint8_t *data, size_t length, void *context) {
+    OTAImage &image = *(OTAImage *)context;
+    memcpy(image.data + offset, data, length);
+    image.size += length;
+    return true;
+  }, &received, 2);
+  assertTrue(download.success);
+  assertEqual(received.size, 5u);
+  assertEqual(received.data[4], 5);
+
+  sim.dropConnection();
+  assertFalse(el.publish(2, "lost"));
+  assertEqual(el.lastError().code, ExpressLink::Error::NotConnected);
+}
+
+test(shadowMirror) {
+  ExpressLinkSimulator sim;
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  assertTrue(el.connect());
+
+  ExpressLinkShadow shadow(el);
+  assertTrue(shadow.reportFloat("temperature", 21.5));
+  assertTrue(shadow.reportBool("led", false));
+  assertEqual(shadow.pending(), 2);
+  assertTrue(shadow.update());
+  assertTrue(el.shadowGetUpdate());
+  assertEqual(el.response, "1 {\"state\":{\"reported\":{\"temperature\":21.50,\"led\":false}}}");
+
+  // unchanged values are not sent again
+  uint32_t commands = sim.commands();
+  assertTrue(shadow.reportFloat("temperature", 21.501));
+  assertTrue(shadow.update());
+  assertEqual(sim.commands(), commands);
+  assertEqual(shadow.statistics().suppressed, 1u);
+
+  assertTrue(shadow.reportBool("led", true));
+  assertTrue(shadow.update());
+  assertTrue(el.shadowGetUpdate());
+  assertEqual(el.response, "1 {\"state\":{\"reported\":{\"led\":true}}}");
+  assertEqual(shadow.statistics().keysSent, 3u);
+
+  int changes = 0;
+  shadow.onDelta([](ExpressLinkShadow &, const char *, const char *, void *context) {
+    (*(int *)context)++;
+  }, &changes);
+  el.onEvent(ExpressLink::SHADOW_DELTA, ExpressLinkShadow::onShadowEvent, &shadow);
+  sim.setShadowDelta(0, "{\"version\":3,\"state\":{\"fan\":2,\"mode\":{\"a\":[1,\"}\"]}}}");
+  sim.pushEvent(ExpressLink::SHADOW_DELTA, 0, "SHADOW_DELTA");
+  el.processEvents();
+  assertEqual(changes, 2);
+  assertEqual(shadow.desired("fan"), "2");
+  assertEqual(shadow.desired("mode"), "{\"a\":[1,\"}\"]}");
+  assertEqual(shadow.mergeDelta("{\"state\":{\"fan\":2}}"), 0);
+
+  // a document with the pending value already reported clears it
+  assertTrue(shadow.reportInt("fan", 2));
+  assertEqual(shadow.mergeDocument("{\"state\":{\"desired\":{\"fan\":3},\"reported\":{\"fan\":2}}}"), 1);
+  assertEqual(shadow.pending(), 0);
+  assertEqual(shadow.desired("fan"), "3");
+  assertTrue(shadow.desired("unknown") == nullptr);
+}
+
+test(cborWriter) {
+  uint8_t buffer[32];
+  ExpressLinkCBOR cbor(buffer, sizeof(buffer));
+  assertTrue(cbor.beginMap(3));
+  assertTrue(cbor.addKey("t"));
+  assertTrue(cbor.addFloat(21.5));
+  assertTrue(cbor.addKey("h"));
+  assertTrue(cbor.addInt(-500));
+  assertTrue(cbor.addKey("v"));
+  assertTrue(cbor.beginArray());
+  assertTrue(cbor.addFloat(0.1));
+  assertTrue(cbor.addBool(true));
+  assertTrue(cbor.end());
+  const uint8_t expected[] = {0xA3, 0x61, 't', 0xF9, 0x4D, 0x60, 0x61, 'h', 0x39, 0x01, 0xF3, 0x61, 'v',
+                              0x9F, 0xFB, 0x3F, 0xB9, 0x99, 0x99, 0x99, 0x99, 0x99, 0x9A, 0xF5, 0xFF};
+  assertEqual(cbor.length(), sizeof(expected));
+  assertEqual(memcmp(cbor.data(), expected, sizeof(expected)), 0);
+
+  cbor.reset();
+  assertFalse(cbor.addString("0123456789012345678901234567890"));
+  assertTrue(cbor.overflowed());
+
+  // the message is sent base64-encoded, so no byte needs escaping
+  MockStream s("AT\nAT+SEND1 Ygpc\nAT+SEND1 IABDACAJCQ==\n", "OK\r\nOK\r\nOK\r\n");
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  cbor.reset();
+  assertTrue(cbor.addString("\n\\"));
+  assertEqual(cbor.wireLength(), (size_t)4);
+  assertTrue(cbor.publish(el, 1));
+
+  cbor.reset();
+  assertTrue(cbor.addInt(-1)); // 0x20, whitespace the module would trim
+  assertTrue(cbor.addUnsigned(0));
+  const uint8_t bytes[] = {0x00, 0x20, 0x09};
+  assertTrue(cbor.addBytes(bytes, sizeof(bytes)));
+  assertTrue(cbor.addUnsigned(9)); // 0x09
+  assertEqual(cbor.wireLength(), (size_t)12);
+  assertTrue(cbor.publish(el, 1));
+  assertTrue(s.valid());
+}
+
+/// @brief Decodes base64 `text` into `data`.
+/// @return number of decoded bytes
+size_t decodeBase64(const char *text, uint8_t *data) {
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t n = 0;
+  uint32_t bits = 0;
+  int count = 0;
+  for (; *text != '\0' && *text != '='; text++) {
+    bits = (bits << 6) | (strchr(digits, *text) - digits);
+    count += 6;
+    if (count >= 8) {
+      count -= 8;
+      data[n++] = bits >> count;
+    }
+  }
+  return n;
+}
+
+test(cborRoundTrip) {
+  ExpressLinkSimulator sim;
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  assertTrue(el.connect());
+  assertTrue(el.subscribe(1, "cbor"));
+
+  // leading and trailing whitespace and null bytes would be lost if sent as-is
+  const uint8_t bytes[] = {0x00, 0x0A, 0x0D, 0x5C, 0x20, 0x09, 0x00};
+  uint8_t buffer[32];
+  ExpressLinkCBOR cbor(buffer, sizeof(buffer));
+  for (size_t length = 0; length < 3; length++) {
+    cbor.reset();
+    assertTrue(cbor.addInt(-1));
+    assertTrue(cbor.addBytes(bytes, sizeof(bytes) - length));
+    assertTrue(cbor.addUnsigned(length == 2 ? 9 : 0));
+    assertTrue(cbor.publish(el, 1));
+
+    char text[64];
+    ExpressLink::Message message;
+    assertTrue(el.receive(1, message, text, sizeof(text)));
+    assertEqual(strlen(message.payload), cbor.wireLength());
+    uint8_t decoded[32];
+    assertEqual(decodeBase64(message.payload, decoded), cbor.length());
+    assertEqual(memcmp(decoded, cbor.data(), cbor.length()), 0);
+  }
+}
+
+test(jsonParser) {
+  String log;
+  ExpressLinkJSON parser([](ExpressLinkJSON &, const ExpressLinkJSON::Value &value, void *context) {
+    String &log = *(String *)context;
+    log += value.path;
+    log += '=';
+    log += value.text;
+    log += ';';
+  }, &log);
+
+  // fed in fragments of 3 bytes
+  const char *json = "{\"a\":1,\"b\":{\"c\":\"x\\\"\\u00e9\",\"d\":[true,null,-2.5e3]},\"e\":\"\\\\n\"}";
+  size_t length = strlen(json);
+  for (size_t i = 0; i < length; i += 3) {
+    assertTrue(parser.feed(json + i, length - i < 3 ? length - i : 3));
+  }
+  assertTrue(parser.finish());
+  assertEqual(log, "=;a=1;b=;b.c=x\"\xc3\xa9;b.d=;b.d.0=true;b.d.1=null;b.d.2=-2.5e3;b.d=;b=;e=\\n;=;");
+
+  log = "";
+  assertTrue(parser.select("b.d.*"));
+  assertTrue(parser.parse(json));
+  assertEqual(log, "b.d.0=true;b.d.1=null;b.d.2=-2.5e3;");
+
+  assertFalse(parser.parse("{\"a\":[1}"));
+  assertTrue(parser.failed());
+}
+
+struct JSONFields {
+  int count;
+  double temperature;
+  String led;
+};
+
+test(jsonStream) {
+  ExpressLinkSimulator sim;
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  assertTrue(el.connect());
+
+  // the document does not fit into the line buffer
+  String doc = "{\"state\":{\"reported\":{\"pad\":\"";
+  for (int i = 0; i < EXPRESSLINK_MAX_LINE; i++) {
+    doc += 'x';
+  }
+  doc += "\",\"temperature\":21.5},\"desired\":{\"led\":\"a\\\\b\"}}}";
+  assertTrue(el.shadowUpdate(doc.c_str()));
+
+  JSONFields fields = {0, 0, ""};
+  ExpressLinkJSON parser([](ExpressLinkJSON &, const ExpressLinkJSON::Value &value, void *context) {
+    JSONFields &fields = *(JSONFields *)context;
+    fields.count++;
+    if (strcmp(value.key, "temperature") == 0) {
+      fields.temperature = value.toFloat();
+    } else if (strcmp(value.key, "led") == 0) {
+      fields.led = value.text;
+    }
+  }, &fields);
+  assertTrue(parser.select("state.reported.temperature"));
+  assertTrue(parser.select("state.desired.*"));
+  assertTrue(parser.shadowGetDoc(el));
+  assertEqual(fields.count, 2);
+  assertEqual(fields.temperature, 21.5);
+  assertEqual(fields.led, "a\\b");
+  assertEqual(el.response, "");
+  assertFalse(parser.shadowGetDelta(el));
+
+  parser.selectAll();
+  fields.count = 0;
+  assertTrue(el.subscribe(1, "sensors"));
+  assertTrue(el.publish(1, "{\"t\":[1,2]}"));
+  assertTrue(parser.get(el));
+  assertEqual(parser.topic(), "sensors");
+  assertEqual(fields.count, 6);
+  assertFalse(parser.get(el));
+  assertTrue(el.cmd("CONF? ThingName"));
+}
+
+struct PEMContents {
+  int lines;
+  int bytes;
+  bool ordered;
+};
+
+test(pemStream) {
+  ExpressLinkSimulator sim;
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+
+  // contains the bytes 0 to 99
+  MockStream file("", "-----BEGIN CERTIFICATE-----\n"
+                      "AAECAwQFBgcICQoLDA0ODxAREhMUFRYXGBkaGxwdHh8gISIjJCUmJygpKissLS4v\n"
+                      "MDEyMzQ1Njc4OTo7PD0+P0BBQkNERUZHSElKS0xNTk9QUVJTVFVWV1hZWltcXV5f\n"
+                      "YGFiYw==\n"
+                      "-----END CERTIFICATE-----\n");
+  assertTrue(el.config.setRootCA(file));
+  assertTrue(file.valid());
+
+  PEMContents contents = {0, 0, true};
+  assertTrue(el.config.getRootCA([](const char *, size_t length, void *context) {
+    PEMContents &contents = *(PEMContents *)context;
+    contents.lines++;
+    contents.bytes += length;
+    return true;
+  }, &contents));
+  assertEqual(contents.lines, 5);
+  assertEqual(contents.bytes, 27 + 64 + 64 + 8 + 25);
+
+  contents = {0, 0, true};
+  assertTrue(el.config.getDER("RootCA", [](const uint8_t *data, size_t length, void *context) {
+    PEMContents &contents = *(PEMContents *)context;
+    for (size_t i = 0; i < length; i++) {
+      contents.ordered = contents.ordered && data[i] == contents.bytes + i;
+    }
+    contents.bytes += length;
+    return true;
+  }, &contents));
+  assertEqual(contents.bytes, 100);
+  assertTrue(contents.ordered);
+
+  // the sink stops reading, the remaining lines are discarded
+  contents = {0, 0, true};
+  assertFalse(el.config.getDER("RootCA", [](const uint8_t *, size_t, void *) {
+    return false;
+  }, &contents));
+  assertTrue(el.cmd("CONF? ThingName"));
+}
+
+#if EXPRESSLINK_STATISTICS
+/// @brief Simulates the module latency on a clock, see `ExpressLink::setClock()`: the response line to each command
+/// becomes available `latency` ms after the command was written, and every poll without a response advances the clock by 1 ms.
+class ClockedStream: public MockStream {
+  public:
+    ClockedStream(String c, String r) : MockStream(c, r) {}
+
+    size_t write(uint8_t c) {
+      if (c == '\n') {
+        due = time + latency;
+        lines++;
+      }
+      return MockStream::write(c);
+    }
+
+    int available() {
+      int n = (lines > 0 && time >= due) ? MockStream::available() : 0;
+      time += (n == 0);
+      return n;
+    }
+
+    int read() {
+      int c = MockStream::read();
+      lines -= (c == '\n');
+      return c;
+    }
+
+    static unsigned long now(void *context) {
+      return ((ClockedStream *)context)->time;
+    }
+
+    unsigned long time = 1000;
+    unsigned long due = 0;
+    uint32_t latency = 0;
+    uint32_t lines = 0;
+};
+
+test(statistics) {
+  ClockedStream s("AT\nAT+CONNECT\nAT+SEND1 hello\nAT+EVENT?\nAT+CONF? Version\n",
+                  "OK\r\nOK 1 CONNECTED\r\nERR10 NOT CONNECTED\r\nOK 1 1 MSG\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  el.setClock(ClockedStream::now, &s);
+  el.setTimeout(10);
+  s.latency = 50;
+  assertTrue(el.connect());
+  s.latency = 0;
+  assertFalse(el.publish(1, "hello"));
+  assertEqual(el.getEvent(false).code, ExpressLink::MSG);
+  assertFalse(el.cmd("CONF? Version")); // times out after 10 ms
+
+  auto stats = el.statistics();
+  const auto &connect = stats.latency[ExpressLink::Statistics::ConnectCommand];
+  assertEqual(connect.count, 1u);
+  assertEqual(connect.histogram[3], 1u); // 16 < 50 <= 64
+  assertEqual(stats.latency[ExpressLink::Statistics::SendCommand].count, 1u);
+  assertEqual(stats.latency[ExpressLink::Statistics::SendCommand].histogram[0], 1u);
+  const auto &conf = stats.latency[ExpressLink::Statistics::ConfCommand];
+  assertEqual(conf.count, 1u);
+  assertEqual(conf.histogram[2], 1u); // 4 < 10 <= 16
+  uint32_t total = 0;
+  for (uint8_t type = 0; type < ExpressLink::Statistics::COMMAND_TYPES; type++) {
+    for (uint8_t bucket = 0; bucket < ExpressLink::Statistics::BUCKETS; bucket++) {
+      total += stats.latency[type].histogram[bucket];
+    }
+  }
+  assertEqual(total, 4u); // every command since begin() lands in exactly one bucket
+  assertEqual(stats.errorCount(ExpressLink::Error::NotConnected), 1u);
+  assertEqual(stats.timeouts, 1u);
+  assertEqual(stats.events[ExpressLink::MSG], 1u);
+  assertEqual(stats.bytesSent, 53u);
+  assertEqual(stats.maxResponse, 19u);
+
+  el.resetStatistics();
+  assertEqual(el.statistics().bytesSent, 0u);
+  assertTrue(s.valid());
+}
+#endif
+
+#if EXPRESSLINK_TRACE && EXPRESSLINK_LOG_LEVEL >= EXPRESSLINK_LOG_DEBUG
+test(logging) {
+  MockStream s("AT\nAT+SEND1 a\\Ab\nAT+CONNECT\n", "OK\r\nERR10 NOT CONNECTED\r\nOK 1 CONNECTED\r\n");
+
+  ExpressLink el;
+  assertTrue(el.begin(s));
+  String log;
+  el.setLogSink([](ExpressLink::LogLevel, const char *text, size_t length, void *context) {
+    for (size_t i = 0; i < length; i++) {
+      *(String *)context += text[i];
+    }
+  }, &log, ExpressLink::LogWarning);
+  assertFalse(el.publish(1, "a\nb"));
+  assertTrue(el.connect());
+  assertEqual(log, "< ERR10 NOT CONNECTED\n");
+
+  assertEqual(el.traceCount(), 5);
+#if EXPRESSLINK_LOG_PAYLOAD
+  assertEqual(el.trace(0).text, "> AT+SEND1 a\\Ab");
+#else
+  assertEqual(el.trace(0).text, "> AT+SEND1 ...");
+#endif
+  assertEqual(el.trace(1).text, "< ERR10 NOT CONNECTED");
+  assertEqual(el.trace(2).text, "> AT+CONNECT");
+  assertEqual(el.trace(3).text, "< OK 1 CONNECTED");
+  assertEqual(el.trace(4).text, "* connected");
+  assertTrue(s.valid());
+}
+#endif
+
+struct IdleLog {
+  int calls = 0;
+  uint32_t elapsed = 0;
+  const ExpressLink::Command *command = nullptr;
+  String name;
+};
+
+test(idleHook) {
+  ExpressLinkSimulator sim;
+  sim.setLatency(20);
+
+  ExpressLink el;
+  assertTrue(el.begin(sim));
+  IdleLog log;
+  el.onIdle([](ExpressLink &, const ExpressLink::Command *command, uint32_t elapsed, void *context) {
+    IdleLog &log = *(IdleLog *)context;
+    log.calls++;
+    log.elapsed = elapsed;
+    log.command = command;
+    log.name = command ? command->name() : "";
+    delayMicroseconds(100);
+  }, &log);
+
+  assertTrue(el.connect());
+  assertMore(log.calls, 0);
+  assertMoreOrEqual(log.elapsed, 15u);
+  assertTrue(log.command != nullptr);
+  assertEqual(log.name, "CONNECT");
+  assertEqual(el.idleStatistics().calls, (uint32_t)log.calls);
+  assertMoreOrEqual(el.idleStatistics().time, (uint64_t)log.calls * 100);
+}